@@ -124,12 +124,13 @@ int main(int argc, char *argv[]) {
   result["in_memory_results"] = nlohmann::ordered_json::array();
   result["gpu_results"] = nlohmann::ordered_json::array();
   result["immediate_flush_results"] = nlohmann::ordered_json::array();
+  result["resident_results"] = nlohmann::ordered_json::array();
   result["memory_limit_results"] = nlohmann::ordered_json::array();
   if (opt.test_load) result["load_results"] = nlohmann::ordered_json::array();
 
   std::vector<std::vector<std::size_t>> inmem_times(opt.max_depth), gpu_times(opt.max_depth),
-                                        immflush_times(opt.max_depth), memlimit_times(opt.max_depth),
-                                        load_times(opt.max_depth);
+                                        immflush_times(opt.max_depth), resident_times(opt.max_depth),
+                                        memlimit_times(opt.max_depth), load_times(opt.max_depth);
   for (auto depth = 1; depth <= opt.max_depth; ++depth) {
     println("Testing depth={}...", depth);
     for (const auto &name : to_query) {
@@ -165,6 +166,19 @@ int main(int argc, char *argv[]) {
     println("Imm-flush      tests completed. Average {:.3f} ms per query.",
             analyze_times(immflush_result, immflush_times[depth - 1], opt.trials));
 
+    immflush_graph.set_memory_resident(true);
+    for (const auto &name : to_query) {
+      auto [_, time] = measure_time<std::chrono::microseconds>([&immflush_graph, &name, depth] {
+        return immflush_graph.query_dependencies(name, "", "", depth, false);
+      });
+      resident_times[depth - 1].emplace_back(time.count());
+    }
+    immflush_graph.set_memory_resident(false);
+    auto &resident_result = result["resident_results"].emplace_back();
+    resident_result["depth"] = depth;
+    println("Resident       tests completed. Average {:.3f} ms per query.",
+            analyze_times(resident_result, resident_times[depth - 1], opt.trials));
+
     for (const auto &name : to_query) {
       auto [_, time] = measure_time<std::chrono::microseconds>([&memlimit_graph, &name, depth] {
         return memlimit_graph.query_dependencies(name, "", "", depth, false);
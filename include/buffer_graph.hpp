@@ -1,39 +1,101 @@
 #pragma once
+#include <cstddef>
 #include <functional>
+#include <iterator>
+#include <limits>
+#include <memory_resource>
 #include <optional>
-#include <string>
 #include <string_view>
 #include <utility>
 #include <vector>
 #include "config.hpp"
-#include "string_map.hpp"
+#include "counting_resource.hpp"
+
+// Ids chained through a next link in their nodes, in the order they were appended.
+template <class Id, class Node, Id Node::*Next>
+class id_chain {
+public:
+  static constexpr Id kEndId = std::numeric_limits<Id>::max();
+
+  class iterator {
+  public:
+    using value_type = Id;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::forward_iterator_tag;
+
+    iterator() noexcept = default;
+    iterator(const Node *nodes, Id id) noexcept : nodes_(nodes), id_(id) {}
+
+    Id operator*() const noexcept { return id_; }
+    iterator &operator++() noexcept {
+      id_ = nodes_[id_].*Next;
+      return *this;
+    }
+    iterator operator++(int) noexcept {
+      auto it = *this;
+      ++*this;
+      return it;
+    }
+    bool operator==(const iterator &other) const noexcept { return id_ == other.id_; }
+
+  private:
+    const Node *nodes_ = nullptr;
+    Id id_ = kEndId;
+  };
+
+  id_chain(const Node *nodes, Id head, std::size_t size) noexcept : nodes_(nodes), head_(head), size_(size) {}
+
+  iterator begin() const noexcept { return {nodes_, head_}; }
+  iterator end() const noexcept { return {nodes_, kEndId}; }
+  std::size_t size() const noexcept { return size_; }
+  bool empty() const noexcept { return size_ == 0; }
+
+private:
+  const Node *nodes_;
+  Id head_;
+  std::size_t size_;
+};
 
 class BufferGraph {
 public:
+  // Strings live in a monotonic arena and id lists are chained through the nodes, so nodes are trivially
+  // destructible and clear() only drops a handful of blocks. Every allocation goes through one counting resource.
   struct PackageNode {
-    std::string name;
-    std::vector<VersionId> version_ids;
+    std::string_view name;
+    VersionId version_count;
+    VersionId first_version_id;
+    VersionId last_version_id;
   };
 
   struct VersionNode {
-    std::string version;
+    PackageId package_id;
+    std::string_view version;
     ArchitectureType architecture;
-    std::vector<DependencyId> dependency_ids;
+    std::uint64_t content_hash;
+    VersionId next_version_id;
+    DependencyId dependency_count;
+    DependencyId first_dependency_id;
+    DependencyId last_dependency_id;
   };
 
   struct DependencyEdge {
     VersionId from_version_id;
     PackageId to_package_id;
-    std::string version_constraint;
+    std::string_view version_constraint;
     ArchitectureType architecture_constraint;
     DependencyType dependency_type;
     GroupId group;
+    DependencyId next_dependency_id;
   };
 
-  BufferGraph() noexcept = default;
+  using version_id_range = id_chain<VersionId, VersionNode, &VersionNode::next_version_id>;
+  using dependency_id_range = id_chain<DependencyId, DependencyEdge, &DependencyEdge::next_dependency_id>;
+
+  BufferGraph(std::size_t chunk_bytes = kDefaultChunkBytes) noexcept;
   ~BufferGraph() noexcept = default;
 
-  std::size_t estimated_memory_usage() const noexcept;
+  // Exact bytes held by the buffer, including arena slack and spare vector capacity.
+  std::size_t memory_usage() const noexcept { return sizeof(BufferGraph) + memory_.allocated_bytes(); }
 
   std::size_t package_count() const noexcept { return package_nodes_.size(); }
   std::size_t version_count() const noexcept { return version_nodes_.size(); }
@@ -43,18 +105,47 @@ public:
   const VersionNode &get_version(VersionId vid) const noexcept { return version_nodes_[vid]; }
   const DependencyEdge &get_dependency(DependencyId did) const noexcept { return dependency_edges_[did]; }
 
+  version_id_range version_ids(PackageId pid) const noexcept {
+    const auto &pnode = package_nodes_[pid];
+    return {version_nodes_.data(), pnode.first_version_id, pnode.version_count};
+  }
+  dependency_id_range dependency_ids(VersionId vid) const noexcept {
+    const auto &vnode = version_nodes_[vid];
+    return {dependency_edges_.data(), vnode.first_dependency_id, vnode.dependency_count};
+  }
+
   std::optional<std::reference_wrapper<const PackageNode>> get_package(std::string_view name) const noexcept;
+  std::optional<PackageId> find_package(std::string_view name) const noexcept;
+  std::optional<VersionId> find_version(PackageId pid, std::string_view version, ArchitectureType arch) const noexcept;
 
   std::pair<PackageId, bool> create_package(std::string_view name);
-  std::pair<VersionId, bool> create_version(PackageId pid, std::string_view version, ArchitectureType arch);
+  std::pair<VersionId, bool> create_version(PackageId pid, std::string_view version, ArchitectureType arch,
+                                            std::uint64_t content_hash = 0);
   std::pair<DependencyId, bool> create_dependency(VersionId from_vid, PackageId to_pid, std::string_view vcons,
                                                   ArchitectureType acons, DependencyType dtype, GroupId gid);
 
   void clear();
 
 private:
-  std::vector<PackageNode> package_nodes_;
-  std::vector<VersionNode> version_nodes_;
-  std::vector<DependencyEdge> dependency_edges_;
-  string_map<PackageId> name_to_package_id_;
+  static constexpr std::size_t kMinSlotCount = 64;
+
+  counting_resource memory_;
+  std::pmr::monotonic_buffer_resource strings_;
+  std::pmr::vector<PackageNode> package_nodes_;
+  std::pmr::vector<VersionNode> version_nodes_;
+  std::pmr::vector<DependencyEdge> dependency_edges_;
+  // Open-addressing tables of id + 1 (0 is empty) that compare keys through the nodes.
+  std::pmr::vector<PackageId> package_slots_;
+  std::pmr::vector<VersionId> version_slots_;
+
+  std::string_view store(std::string_view str);
+
+  static std::size_t package_hash(std::string_view name) noexcept;
+  static std::size_t version_hash(PackageId pid, std::string_view version, ArchitectureType arch) noexcept;
+  std::size_t version_hash(VersionId vid) const noexcept;
+
+  template <class Id, class Equal>
+  static std::optional<Id> find_slot(const std::pmr::vector<Id> &slots, std::size_t hash, Equal &&equal) noexcept;
+  template <class Id, class Hash>
+  static void insert_slot(std::pmr::vector<Id> &slots, std::size_t count, Id id, std::size_t hash, Hash &&rehash);
 };
@@ -17,8 +17,11 @@ class BufferGraph;
 class GpuGraph;
 class PackageLoader;
 
-enum open_mode : std::uint8_t { kLoad, kCreate, kLoadOrCreate };
+enum open_mode : std::uint8_t { kLoad, kCreate, kLoadOrCreate, kReadOnly };
 enum open_code : std::uint8_t { kOpenFailed, kCreateSuccess, kLoadSuccess };
+enum durability_mode : std::uint8_t { kSyncNone, kSyncAsync, kSyncFull };
+enum access_advice : std::uint8_t { kAdviceNormal, kAdviceRandom, kAdviceSequential };
+enum verify_state : std::uint8_t { kVerifyPending, kVerifyRunning, kVerifyPassed, kVerifyFailed, kVerifyUnavailable };
 
 inline constexpr std::size_t KiB = 1024;
 inline constexpr std::size_t MiB = 1024 * KiB;
@@ -28,5 +31,10 @@ inline constexpr double MiB_d = 1024.0 * KiB_d;
 inline constexpr double GiB_d = 1024.0 * MiB_d;
 inline constexpr std::size_t kDefaultChunkBytes = 1 * MiB;
 inline constexpr std::size_t kSmallChunkBytes = 256;
+inline constexpr double kDefaultGrowthFactor = 1.5;
 inline constexpr std::size_t kDefaultMemoryLimit = 1 * GiB;
+inline constexpr std::size_t kMinMidFileFlushBytes = 16 * MiB;
+inline constexpr std::size_t kInputRegionBytes = 16 * MiB;
+inline constexpr std::size_t kPipelineRegionBytes = 4 * MiB;
 inline constexpr std::size_t kDefaultMaxDeviceVectorBytes = 64 * MiB;
+inline constexpr std::size_t kDefaultPackedAlignment = 4 * KiB;
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <memory_resource>
+
+// Forwards to an upstream resource and keeps a running total of the bytes it currently holds.
+class counting_resource : public std::pmr::memory_resource {
+public:
+  explicit counting_resource(std::pmr::memory_resource *upstream = std::pmr::get_default_resource()) noexcept
+    : upstream_(upstream) {}
+
+  counting_resource(const counting_resource &) = delete;
+  counting_resource &operator=(const counting_resource &) = delete;
+
+  std::pmr::memory_resource *upstream_resource() const noexcept { return upstream_; }
+  std::size_t allocated_bytes() const noexcept { return allocated_bytes_; }
+
+private:
+  std::pmr::memory_resource *upstream_;
+  std::size_t allocated_bytes_ = 0;
+
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+    auto *p = upstream_->allocate(bytes, alignment);
+    allocated_bytes_ += bytes;
+    return p;
+  }
+
+  void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override {
+    upstream_->deallocate(p, bytes, alignment);
+    allocated_bytes_ -= bytes;
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+};
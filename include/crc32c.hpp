@@ -0,0 +1,67 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#define CRC32C_HAS_SSE42_PATH 1
+#endif
+
+constexpr std::array<std::uint32_t, 256> make_crc32c_table() noexcept {
+  std::array<std::uint32_t, 256> table{};
+  for (std::uint32_t i = 0; i < 256; ++i) {
+    auto crc = i;
+    for (int bit = 0; bit < 8; ++bit) crc = crc & 1 ? crc >> 1 ^ 0x82f63b78u : crc >> 1;
+    table[i] = crc;
+  }
+  return table;
+}
+
+inline constexpr auto kCrc32cTable = make_crc32c_table();
+
+inline std::uint32_t crc32c_portable(std::uint32_t crc, const unsigned char *data, std::size_t length) noexcept {
+  for (; length > 0; ++data, --length) crc = kCrc32cTable[(crc ^ *data) & 0xff] ^ crc >> 8;
+  return crc;
+}
+
+#if defined(CRC32C_HAS_SSE42_PATH)
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("sse4.2")))
+#endif
+inline std::uint32_t crc32c_sse42(std::uint32_t crc, const unsigned char *data, std::size_t length) noexcept {
+  std::uint64_t state = crc;
+  for (; length >= sizeof(std::uint64_t); data += sizeof(std::uint64_t), length -= sizeof(std::uint64_t)) {
+    std::uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    state = _mm_crc32_u64(state, word);
+  }
+  crc = static_cast<std::uint32_t>(state);
+  for (; length > 0; ++data, --length) crc = _mm_crc32_u8(crc, *data);
+  return crc;
+}
+
+inline bool crc32c_hardware() noexcept {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return info[2] & (1 << 20);
+#else
+  return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#endif
+
+// CRC-32C (Castagnoli); pass a previous result as crc to continue a running checksum.
+inline std::uint32_t crc32c(const void *data, std::size_t length, std::uint32_t crc = 0) noexcept {
+  const auto *bytes = static_cast<const unsigned char *>(data);
+#if defined(CRC32C_HAS_SSE42_PATH)
+  static const bool hardware = crc32c_hardware();
+  if (hardware) return ~crc32c_sse42(~crc, bytes, length);
+#endif
+  return ~crc32c_portable(~crc, bytes, length);
+}
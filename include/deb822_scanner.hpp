@@ -0,0 +1,125 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string_view>
+#include "util.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DEB822_HAS_SSE2_PATH 1
+#endif
+
+// Bit i is set when data[i] is a newline; length is at most 64.
+inline std::uint64_t newline_mask(const char *data, std::size_t length) noexcept {
+#if defined(DEB822_HAS_SSE2_PATH)
+  if (length == 64) {
+    auto newline = _mm_set1_epi8('\n');
+    std::uint64_t mask = 0;
+    for (int i = 0; i < 4; ++i) {
+      auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i * 16));
+      mask |= std::uint64_t(static_cast<std::uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)))) << i * 16;
+    }
+    return mask;
+  }
+#endif
+  std::uint64_t mask = 0;
+  for (std::size_t i = 0; i < length; ++i) mask |= std::uint64_t(data[i] == '\n') << i;
+  return mask;
+}
+
+// Walks deb822 stanzas 64 bytes of newlines at a time and keeps only the requested fields. Stanzas are delimited
+// exactly as splitting on "\n\n" would, so their content hashes do not depend on the scanner; in CRLF input a line
+// holding only "\r" separates stanzas as well.
+class deb822_scanner {
+public:
+  deb822_scanner(std::string_view text, std::span<const std::string_view> fields) noexcept
+    : text_(text), fields_(fields), done_(text.empty()) {}
+
+  // Fills values, one per field, with the trimmed value of each field the stanza sets. A continuation line extends
+  // the field above it and a repeated field keeps its first value.
+  bool next(std::string_view &stanza, std::span<std::optional<std::string_view>> values) noexcept {
+    if (done_) return false;
+    for (auto &value : values) value.reset();
+    auto start = position_, line_start = position_;
+    std::size_t field = fields_.size();
+    for (;;) {
+      auto line_end = next_newline(line_start);
+      scan_line(line_start, line_end, field, values);
+      if (line_end == text_.size()) {
+        stanza = text_.substr(start);
+        done_ = true;
+        break;
+      }
+      if (auto separator = separator_length(line_end)) {
+        stanza = text_.substr(start, line_end - start);
+        position_ = line_end + separator;
+        break;
+      }
+      line_start = line_end + 1;
+    }
+    for (auto &value : values) if (value) value = trim(*value);
+    return true;
+  }
+
+private:
+  std::string_view text_;
+  std::span<const std::string_view> fields_;
+  std::size_t position_ = 0;
+  std::size_t block_ = 0;
+  std::size_t next_block_ = 0;
+  std::uint64_t mask_ = 0;
+  bool done_;
+
+  // Length of the separator starting at the newline at position, or 0 if the next line holds text.
+  std::size_t separator_length(std::size_t position) const noexcept {
+    auto rest = text_.substr(position);
+    if (rest.starts_with("\n\n")) return 2;
+    if (rest.starts_with("\n\r\n")) return 3;
+    return rest == "\n\r" ? 2 : 0;
+  }
+
+  std::size_t next_newline(std::size_t from) noexcept {
+    for (;;) {
+      for (; mask_ != 0; mask_ &= mask_ - 1) {
+        auto position = block_ + std::countr_zero(mask_);
+        if (position >= from) {
+          mask_ &= mask_ - 1;
+          return position;
+        }
+      }
+      if (next_block_ >= text_.size()) return text_.size();
+      block_ = next_block_;
+      next_block_ += 64;
+      mask_ = newline_mask(text_.data() + block_, std::min<std::size_t>(64, text_.size() - block_));
+    }
+  }
+
+  void scan_line(std::size_t first, std::size_t last, std::size_t &field,
+                 std::span<std::optional<std::string_view>> values) const noexcept {
+    const auto *line = text_.data() + first;
+    if (last > first && text_[last - 1] == '\r') --last;
+    if (first == last) {
+      field = fields_.size();
+    } else if (*line == ' ' || *line == '\t') {
+      if (field < fields_.size()) values[field] = std::string_view(values[field]->data(), text_.data() + last);
+    } else {
+      field = fields_.size();
+      const auto *colon = static_cast<const char *>(std::memchr(line, ':', last - first));
+      if (!colon) return;
+      auto name = trim(std::string_view(line, colon));
+      for (std::size_t i = 0; i < fields_.size(); ++i)
+        if (fields_[i] == name) {
+          if (!values[i]) {
+            values[i] = std::string_view(colon + 1, text_.data() + last);
+            field = i;
+          }
+          break;
+        }
+    }
+  }
+};
@@ -1,6 +1,10 @@
 #pragma once
 #include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <string_view>
 #include <utility>
 #include <vector>
@@ -23,18 +27,82 @@ public:
 
   open_code open(const std::filesystem::path &directory_path, open_mode mode = open_mode::kLoadOrCreate) noexcept;
   void close();
-  void sync() { disk_graph_.sync(); }
+  void sync() {
+    wait_flush();
+    disk_graph_.sync();
+  }
+  void sync(durability_mode mode) {
+    wait_flush();
+    disk_graph_.sync(mode);
+  }
+
+  void export_packed(const std::filesystem::path &file_path, std::size_t alignment = kDefaultPackedAlignment) const {
+    disk_graph_.export_packed(file_path, alignment);
+  }
+  bool packed() const noexcept { return disk_graph_.packed(); }
 
   void flush_buffer();
   bool flush_buffer_if_needed();
-
-  void sync_gpu() { gpu_graph_.build(disk_graph_, kDefaultMaxDeviceVectorBytes); }
+  // Waits for a background flush to commit and rethrows its error, if any.
+  void wait_flush();
+  // For a buffer that will become a repository's contents: the disk ids of the flushed versions are appended to
+  // version_ids, to be passed on to replace_repository.
+  void flush_buffer(std::vector<VersionId> &version_ids);
+
+  // Flushes the buffer as the complete new contents of the named repository, so it must hold nothing else besides
+  // version_ids, the versions already on disk that the repository keeps.
+  void replace_repository(std::string_view name, std::vector<VersionId> version_ids = {});
+  bool has_repository(std::string_view name) const { return disk_graph_.has_repository(name); }
+  void compact();
+
+  void sync_gpu() {
+    wait_flush();
+    gpu_graph_.build(disk_graph_, kDefaultMaxDeviceVectorBytes);
+  }
   void free_gpu() { gpu_graph_.free(); }
 
+  bool read_only() const noexcept { return disk_graph_.read_only(); }
+
+  DiskGraph::Snapshot snapshot() const { return disk_graph_.snapshot(); }
+
+  durability_mode durability() const noexcept { return disk_graph_.durability(); }
+  void set_durability(durability_mode durability) noexcept { disk_graph_.set_durability(durability); }
+
+  bool populate() const noexcept { return disk_graph_.populate(); }
+  void set_populate(bool populate) noexcept { disk_graph_.set_populate(populate); }
+
+  bool compressed_strings() const noexcept { return disk_graph_.compressed_strings(); }
+  void set_compressed_strings(bool compressed) noexcept { disk_graph_.set_compressed_strings(compressed); }
+
+  bool memory_resident() const noexcept { return disk_graph_.memory_resident(); }
+  void set_memory_resident(bool resident) noexcept { disk_graph_.set_memory_resident(resident); }
+
+  std::size_t warmup(std::size_t budget_bytes) { return disk_graph_.warmup(budget_bytes); }
+  double resident_fraction() const noexcept { return disk_graph_.resident_fraction(); }
+
+  std::size_t ingest_threads() const noexcept { return disk_graph_.ingest_threads(); }
+  void set_ingest_threads(std::size_t ingest_threads) noexcept { disk_graph_.set_ingest_threads(ingest_threads); }
+
+  bool background_verify() const noexcept { return disk_graph_.background_verify(); }
+  void set_background_verify(bool background_verify) noexcept { disk_graph_.set_background_verify(background_verify); }
+
+  bool verify() { return disk_graph_.verify(); }
+  GraphStats stats() const { return disk_graph_.stats(); }
+
+  // A full buffer is handed to a flusher thread and loading continues into a second one, so up to twice the memory
+  // limit may be buffered. Loading waits only when the second buffer fills before the first is committed.
+  bool background_flush() const noexcept { return background_flush_; }
+  void set_background_flush(bool background_flush) {
+    wait_flush();
+    background_flush_ = background_flush;
+  }
+
   std::size_t memory_limit() const noexcept { return memory_limit_; }
   void set_memory_limit(std::size_t memory_limit) noexcept { memory_limit_ = memory_limit; }
 
-  std::size_t estimated_memory_usage() const noexcept;
+  // Exact and O(1): the buffer allocates through a counting memory resource. A buffer being flushed in the
+  // background is not counted.
+  std::size_t memory_usage() const noexcept;
 
   std::size_t architecture_count() const noexcept { return disk_graph_.architecture_count(); }
   std::size_t dependency_type_count() const noexcept { return disk_graph_.dependency_type_count(); }
@@ -42,10 +110,18 @@ public:
   std::size_t package_count() const noexcept { return disk_graph_.package_count(); }
   std::size_t version_count() const noexcept { return disk_graph_.version_count(); }
   std::size_t dependency_count() const noexcept { return disk_graph_.dependency_count(); }
+  std::size_t tombstone_count() const noexcept { return disk_graph_.tombstone_count(); }
+
+  std::optional<SourceFile> find_source(std::uint64_t path_hash) const;
+  // Recorded with the next flush, so a source is only ever found once its contents are committed.
+  void record_source(const SourceFile &source) { pending_sources_.push_back(source); }
+  // Misses while a background flush is writing the stanza index; the stanza is then parsed and deduplicated on ingest.
+  std::optional<VersionId> find_stanza(std::uint64_t content_hash, std::string_view package, std::string_view version,
+                                       std::string_view architecture) const;
 
-  std::size_t buffer_package_count() const noexcept { return buf_graph_.package_count(); }
-  std::size_t buffer_version_count() const noexcept { return buf_graph_.version_count(); }
-  std::size_t buffer_dependency_count() const noexcept { return buf_graph_.dependency_count(); }
+  std::size_t buffer_package_count() const noexcept { return buf_graph_->package_count(); }
+  std::size_t buffer_version_count() const noexcept { return buf_graph_->version_count(); }
+  std::size_t buffer_dependency_count() const noexcept { return buf_graph_->dependency_count(); }
 
   const symbol_table<ArchitectureType> &architectures() const noexcept { return disk_graph_.architectures_; }
   const symbol_table<DependencyType> &dependency_types() const noexcept { return disk_graph_.dependency_types_; }
@@ -56,16 +132,22 @@ public:
 
   std::optional<PackageView> get_package(std::string_view name) const noexcept { return disk_graph_.get_package(name); }
 
-  ArchitectureType add_architecture(std::string_view version) { return disk_graph_.add_architecture(version); }
-  DependencyType add_dependency_type(std::string_view dtype) { return disk_graph_.add_dependency_type(dtype); }
+  ArchitectureType add_architecture(std::string_view arch);
+  DependencyType add_dependency_type(std::string_view dtype);
 
   std::pair<PackageId, bool> create_package(std::string_view name);
-  std::pair<VersionId, bool> create_version(PackageId pid, std::string_view version, ArchitectureType arch);
+  std::pair<VersionId, bool> create_version(PackageId pid, std::string_view version, ArchitectureType arch,
+                                            std::uint64_t content_hash = 0);
   std::pair<DependencyId, bool> create_dependency(VersionId from_vid, PackageId to_pid, std::string_view vcons,
                                                   ArchitectureType acons, DependencyType dtype, GroupId gid);
 
+  // Treats the buffers as an overlay on the flushed graph, so loaded data is queryable before it is flushed, with
+  // the results a flush would give. The GPU only sees the flushed graph, as does a query given a snapshot.
   DependencyResult query_dependencies(std::string_view name, std::string_view version, std::string_view arch,
                                       std::size_t depth, bool use_gpu) const;
+  DependencyResult query_dependencies(const DiskGraph::Snapshot &snapshot, std::string_view name,
+                                      std::string_view version, std::string_view arch, std::size_t depth,
+                                      bool use_gpu) const;
   DependencyResult query_dependencies_on_buffer(std::string_view name, std::string_view version, std::string_view arch,
                                                 std::size_t depth) const;
 
@@ -73,10 +155,32 @@ private:
   friend class GpuGraph;
 
   DiskGraph disk_graph_;
-  BufferGraph buf_graph_;
+  std::unique_ptr<BufferGraph> buf_graph_;
+  std::unique_ptr<BufferGraph> flush_graph_;
   GpuGraph gpu_graph_;
   std::size_t memory_limit_;
-
-  DependencyResult query_dependencies_on_disk(std::vector<VersionId> &frontier, std::size_t depth) const;
+  bool background_flush_ = false;
+  std::vector<SourceFile> pending_sources_;
+  // The flusher ingests flush_graph_ and commits; the loader only touches the disk graph through lookups that are
+  // safe alongside it.
+  std::future<void> pending_flush_;
+  mutable std::mutex source_mutex_;
+  // Held shared by queries reading the buffers, and exclusively to add to the live buffer, swap the buffers or clear
+  // one. A buffer is cleared only after the commit that flushed it.
+  mutable std::shared_mutex buffer_mutex_;
+
+  void clear_buffer();
+  void ingest_buffer(std::vector<VersionId> &version_ids);
+  void record_sources(std::vector<SourceFile> &sources);
+  void flush_buffer_in_background();
+
+  DependencyResult query_dependencies_on_disk(const DiskGraph::Snapshot &snapshot, std::vector<VersionId> &frontier,
+                                              std::size_t depth) const;
   DependencyResult query_dependencies_on_gpu(std::vector<VersionId> &frontier, std::size_t depth) const;
+  DependencyResult query_dependencies_with_buffer(const DiskGraph::Snapshot &snapshot, std::string_view name,
+                                                  std::string_view version, std::string_view arch,
+                                                  std::size_t depth) const;
+  std::string_view pool_string(DependencyResult &result, string_handle_offset_t offset,
+                               string_handle_length_t length) const;
+  static std::string_view buffer_string(DependencyResult &result, std::string_view str);
 };
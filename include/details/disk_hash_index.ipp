@@ -0,0 +1,171 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <utility>
+#include <vector>
+
+template <class Key>
+disk_hash_index<Key>::disk_hash_index(const path_type &path, open_mode mode, size_type chunk_bytes) noexcept
+  : disk_hash_index(chunk_bytes) { open(path, mode); }
+
+template <class Key>
+open_code disk_hash_index<Key>::open(const path_type &path, open_mode mode) noexcept {
+  using enum open_code;
+  auto code = table_.open(path, mode);
+  if (code == kLoadSuccess) {
+    bool valid = table_.size() >= header_size();
+    if (valid && std::as_const(*this).header().magic == kLegacyMagic)
+      valid = mode != open_mode::kReadOnly && upgrade_legacy();
+    if (valid && validate_layout()) return code;
+    table_.close();
+    if (mode == open_mode::kLoad || mode == open_mode::kReadOnly) return kOpenFailed;
+    code = table_.open(path, open_mode::kCreate);
+  }
+  if (code == kCreateSuccess) {
+    table_.resize(header_size());
+    header().magic = kMagic;
+    header().layout = pack({.offset = 0, .bucket_count = 0});
+    header().size = 0;
+    header().reserved = 0;
+  }
+  return code;
+}
+
+template <class Key>
+bool disk_hash_index<Key>::attach(const char *image, size_type length) noexcept {
+  if (table_.attach(image, length) && validate_layout()) return true;
+  table_.close();
+  return false;
+}
+
+template <class Key>
+bool disk_hash_index<Key>::validate_layout() const noexcept {
+  if (table_.size() < header_size() || header().magic != kMagic) return false;
+  auto [offset, bucket_count] = layout();
+  return table_.size() >= header_size() + (offset + bucket_count) * sizeof(slot_t);
+}
+
+template <class Key>
+bool disk_hash_index<Key>::upgrade_legacy() noexcept {
+  const auto &legacy = *reinterpret_cast<const legacy_header_t *>(std::as_const(table_).data());
+  if (legacy.rehashing || table_.size() != header_size() + legacy.bucket_count * sizeof(slot_t)) return false;
+  auto bucket_count = legacy.bucket_count;
+  header().layout = pack({.offset = 0, .bucket_count = bucket_count});
+  header().reserved = 0;
+  header().magic = kMagic;
+  return true;
+}
+
+template <class Key>
+std::size_t disk_hash_index<Key>::pack(layout_t layout) noexcept {
+  auto shift = layout.bucket_count ? std::countr_zero(layout.bucket_count) + 1 : 0;
+  return layout.offset << 8 | shift;
+}
+
+template <class Key>
+auto disk_hash_index<Key>::unpack(std::size_t packed) noexcept -> layout_t {
+  auto shift = packed & 0xff;
+  return {.offset = packed >> 8, .bucket_count = shift ? size_type(1) << (shift - 1) : 0};
+}
+
+template <class Key>
+auto disk_hash_index<Key>::layout() const noexcept -> layout_t {
+  return unpack(std::atomic_ref(const_cast<std::size_t &>(header().layout)).load(std::memory_order_acquire));
+}
+
+template <class Key>
+void disk_hash_index<Key>::publish(layout_t layout) noexcept {
+  std::atomic_ref(header().layout).store(pack(layout), std::memory_order_release);
+}
+
+template <class Key>
+auto disk_hash_index<Key>::fold(std::uint64_t hash) noexcept -> hash_type {
+  auto folded = static_cast<hash_type>(hash ^ (hash >> 32));
+  return folded ? folded : 1;
+}
+
+template <class Key>
+template <class Pred>
+auto disk_hash_index<Key>::find(std::uint64_t hash, Pred &&pred) const -> std::optional<key_type> {
+  auto [offset, bucket_count] = layout();
+  if (bucket_count == 0) return std::nullopt;
+  const auto *table = slots() + offset;
+  auto h = fold(hash);
+  auto mask = bucket_count - 1;
+  for (auto i = h & mask;; i = (i + 1) & mask) {
+    auto slot_hash = std::atomic_ref(const_cast<hash_type &>(table[i].hash)).load(std::memory_order_acquire);
+    if (slot_hash == 0) return std::nullopt;
+    if (slot_hash == h && pred(table[i].key)) return table[i].key;
+  }
+}
+
+template <class Key>
+void disk_hash_index<Key>::place(size_type offset, size_type bucket_count, hash_type hash,
+                                 const key_type &key) noexcept {
+  const auto *table = slots() + offset;
+  auto mask = bucket_count - 1;
+  auto i = hash & mask;
+  while (table[i].hash != 0) i = (i + 1) & mask;
+  auto &target = slot(offset + i);
+  target.key = key;
+  std::atomic_ref(target.hash).store(hash, std::memory_order_release);
+}
+
+template <class Key>
+void disk_hash_index<Key>::insert(std::uint64_t hash, const key_type &key) {
+  static_assert(std::is_trivially_copyable_v<Key>);
+  reserve(size() + 1);
+  auto [offset, bucket_count] = layout();
+  place(offset, bucket_count, fold(hash), key);
+  ++header().size;
+}
+
+template <class Key>
+void disk_hash_index<Key>::reserve(size_type count) {
+  if (count * 4 <= bucket_count() * 3) return;
+  rehash(std::bit_ceil(std::max(kMinBucketCount, count * 2)));
+}
+
+template <class Key>
+void disk_hash_index<Key>::rehash(size_type new_bucket_count) {
+  auto [offset, bucket_count] = layout();
+  auto new_offset = offset + bucket_count;
+  table_.resize(header_size() + (new_offset + new_bucket_count) * sizeof(slot_t));
+  for (size_type i = offset; i < offset + bucket_count; ++i)
+    if (slots()[i].hash != 0) place(new_offset, new_bucket_count, slots()[i].hash, slots()[i].key);
+  table_.sync(durability());
+  publish({.offset = new_offset, .bucket_count = new_bucket_count});
+}
+
+template <class Key>
+void disk_hash_index<Key>::shrink_to_fit() {
+  auto [offset, bucket_count] = layout();
+  if (offset == 0) return;
+  std::vector<slot_t> live(slots() + offset, slots() + offset + bucket_count);
+  header().magic = 0;
+  table_.sync(durability());
+  publish({.offset = 0, .bucket_count = bucket_count});
+  table_.resize(header_size() + bucket_count * sizeof(slot_t));
+  std::memcpy(table_.mutable_data(header_size(), bucket_count * sizeof(slot_t)), live.data(),
+              bucket_count * sizeof(slot_t));
+  table_.sync(durability());
+  header().magic = kMagic;
+  table_.sync(durability());
+}
+
+template <class Key>
+void disk_hash_index<Key>::write_image(std::ostream &os) const {
+  auto [offset, bucket_count] = layout();
+  header_t header{
+    .magic = kMagic, .layout = pack({.offset = 0, .bucket_count = bucket_count}), .size = size(), .reserved = 0};
+  table_.write_image_header(os, header_size() + bucket_count * sizeof(slot_t));
+  os.write(reinterpret_cast<const char *>(&header), header_size());
+  os.write(reinterpret_cast<const char *>(slots() + offset), bucket_count * sizeof(slot_t));
+}
+
+template <class Key>
+void disk_hash_index<Key>::clear() {
+  table_.resize(header_size());
+  header().layout = pack({.offset = 0, .bucket_count = 0});
+  header().size = 0;
+}
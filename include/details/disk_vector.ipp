@@ -1,21 +1,198 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <memory>
+#include <new>
 #include <system_error>
 #include <type_traits>
 #include <utility>
 #include "config.hpp"
+#include "epoch.hpp"
+
+#if defined(_WIN32)
+#include <psapi.h>
+#else
+#include <sys/mman.h>
+#endif
+#if defined(__linux__)
+#include <fcntl.h>
+#endif
 
 template <class T>
 disk_vector<T>::disk_vector(const path_type &path, open_mode mode, size_type chunk_bytes) noexcept
   : disk_vector(chunk_bytes) { open(path, mode); }
 
 template <class T>
-bool disk_vector<T>::load(const path_type &path) noexcept {
+void disk_vector<T>::map(std::error_code &error) {
+  if (read_only_) source_.map(path_.string(), error);
+  else mmap_.map(path_.string(), error);
+  if (error) return;
+  publish();
+  set_advice(advice_);
+  if (populate_) prefetch(mapped_length());
+}
+
+template <class T>
+void disk_vector<T>::set_advice(access_advice advice) noexcept {
+  advice_ = advice;
+  if (!is_open()) return;
+#if !defined(_WIN32)
+  int native = advice == kAdviceRandom ? MADV_RANDOM : advice == kAdviceSequential ? MADV_SEQUENTIAL : MADV_NORMAL;
+  ::madvise(const_cast<char *>(mapping()), mapped_length(), native);
+#endif
+}
+
+template <class T>
+void disk_vector<T>::set_resident(bool resident) noexcept {
+  resident_ = resident;
+  if (!is_open()) return;
+  if (resident_) load_memory();
+  else release_memory();
+}
+
+template <class T>
+void disk_vector<T>::load_memory() noexcept {
+  // A writable copy spans the whole mapping, so appends within capacity() land in it without reallocating.
+  auto length = read_only_ ? size_bytes() : mapped_length();
+  if (memory_ && memory_length_ >= length) return;
+  bool huge = length >= kHugePageBytes;
+  auto alignment = huge ? kHugePageBytes : mio::page_size();
+  length = (length + alignment - 1) / alignment * alignment;
+  auto word_count = (length / kDirtyBlockBytes + 63) / 64;
+  std::unique_ptr<std::uint64_t[]> dirty(new (std::nothrow) std::uint64_t[word_count]());
+  if (!dirty) return release_memory();
+#if defined(_WIN32)
+  auto *memory = static_cast<char *>(::VirtualAlloc(nullptr, length, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+  if (!memory) return release_memory();
+#else
+  auto reserved = huge ? length + kHugePageBytes : length;
+  auto *raw = static_cast<char *>(
+    ::mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (raw == MAP_FAILED) return release_memory();
+  auto *memory = raw;
+  if (huge) {
+    // THP only backs 2 MiB aligned ranges, so trim the reservation down to an aligned window.
+    auto aligned = (reinterpret_cast<std::uintptr_t>(raw) + kHugePageBytes - 1) & ~(kHugePageBytes - 1);
+    memory = reinterpret_cast<char *>(aligned);
+    if (memory != raw) ::munmap(raw, memory - raw);
+    if (raw + reserved != memory + length) ::munmap(memory + length, raw + reserved - (memory + length));
+#if defined(MADV_HUGEPAGE)
+    ::madvise(memory, length, MADV_HUGEPAGE);
+#endif
+  }
+#endif
+  // Growing carries the unflushed blocks over, since the old copy still holds writes the file has not seen.
+  std::memcpy(memory, memory_ ? memory_ : mapping(), size_bytes());
+  if (memory_) std::copy_n(dirty_.get(), (memory_length_ / kDirtyBlockBytes + 63) / 64, dirty.get());
+  auto *previous = std::exchange(memory_, memory);
+  auto previous_length = std::exchange(memory_length_, length);
+  dirty_ = std::move(dirty);
+  publish();
+  if (previous) retire_memory(previous, previous_length);
+}
+
+template <class T>
+char *disk_vector<T>::writable_data(size_type offset, size_type length) {
+  if (read_only_) throw std::system_error(std::make_error_code(std::errc::read_only_file_system));
+  if (!memory_) return const_cast<char *>(mapping());
+  if (length == 0) return memory_;
+  for (auto block = offset / kDirtyBlockBytes; block <= (offset + length - 1) / kDirtyBlockBytes; ++block) {
+    // Ingest fills disjoint elements from several threads, and their blocks may share a word.
+    std::atomic_ref word(dirty_[block / 64]);
+    auto bit = std::uint64_t(1) << block % 64;
+    if (!(word.load(std::memory_order_relaxed) & bit)) word.fetch_or(bit, std::memory_order_relaxed);
+  }
+  return memory_;
+}
+
+template <class T>
+void disk_vector<T>::flush_memory() noexcept {
+  if (!memory_ || read_only_) return;
+  auto *target = const_cast<char *>(mapping());
+  auto length = mapped_length();
+  for (size_type word = 0; word * 64 * kDirtyBlockBytes < length; ++word)
+    for (auto bits = std::exchange(dirty_[word], 0); bits; bits &= bits - 1) {
+      auto offset = (word * 64 + std::countr_zero(bits)) * kDirtyBlockBytes;
+      if (offset < length) std::memcpy(target + offset, memory_ + offset, std::min(kDirtyBlockBytes, length - offset));
+    }
+}
+
+template <class T>
+void disk_vector<T>::retire_memory(char *memory, size_type length) noexcept {
+  epoch_domain::global().retire([memory, length] {
+#if defined(_WIN32)
+    ::VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    ::munmap(memory, length);
+#endif
+  });
+}
+
+template <class T>
+void disk_vector<T>::release_memory() noexcept {
+  if (!memory_) return;
+  flush_memory();
+  auto *memory = std::exchange(memory_, nullptr);
+  auto length = std::exchange(memory_length_, 0);
+  dirty_.reset();
+  publish();
+  retire_memory(memory, length);
+}
+
+template <class T>
+auto disk_vector<T>::prefetch(size_type max_bytes) noexcept -> size_type {
+  if (!is_open()) return 0;
+  auto length = std::min(max_bytes, mapped_length());
+  if (length == 0) return 0;
+  auto *first = reinterpret_cast<const volatile char *>(mapping());
+#if defined(_WIN32)
+  WIN32_MEMORY_RANGE_ENTRY range{.VirtualAddress = const_cast<char *>(mapping()), .NumberOfBytes = length};
+  ::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0);
+#else
+#if defined(MADV_POPULATE_READ)
+  if (::madvise(const_cast<char *>(mapping()), length, MADV_POPULATE_READ) == 0) return length;
+#endif
+  ::madvise(const_cast<char *>(mapping()), length, MADV_WILLNEED);
+#endif
+  for (size_type offset = 0; offset < length; offset += mio::page_size()) first[offset];
+  return length;
+}
+
+template <class T>
+auto disk_vector<T>::resident_bytes() const noexcept -> size_type {
+  if (!is_open()) return 0;
+  constexpr size_type kBatchPages = 512;
+  auto page_size = mio::page_size();
+  auto length = size_bytes();
+  auto *first = const_cast<char *>(mapping());
+  size_type resident = 0;
+  // Pages are queried in fixed batches on the stack, so counting never allocates.
+  for (size_type offset = 0; offset < length; offset += kBatchPages * page_size) {
+    auto count = std::min(kBatchPages, (length - offset + page_size - 1) / page_size);
+#if defined(_WIN32)
+    PSAPI_WORKING_SET_EX_INFORMATION pages[kBatchPages];
+    for (size_type i = 0; i < count; ++i) pages[i].VirtualAddress = first + offset + i * page_size;
+    if (!::QueryWorkingSetEx(::GetCurrentProcess(), pages, static_cast<DWORD>(count * sizeof(pages[0])))) return 0;
+    for (size_type i = 0; i < count; ++i) resident += pages[i].VirtualAttributes.Valid;
+#else
+    unsigned char pages[kBatchPages];
+    if (::mincore(first + offset, std::min(length - offset, kBatchPages * page_size), pages) != 0) return 0;
+    for (size_type i = 0; i < count; ++i) resident += pages[i] & 1;
+#endif
+  }
+  return std::min(resident * page_size, length);
+}
+
+template <class T>
+bool disk_vector<T>::load(const path_type &path, bool read_only) noexcept {
   close();
   path_ = path;
+  read_only_ = read_only;
   std::error_code error;
   auto exists = std::filesystem::exists(path_, error);
   if (error || !exists) return false;
@@ -23,12 +200,15 @@ bool disk_vector<T>::load(const path_type &path) noexcept {
   if (error || !is_regular_file) return false;
   auto file_size = std::filesystem::file_size(path_, error);
   if (error || file_size < header_size()) return false;
-  mmap_.map(path_.string(), error);
+  map(error);
   if (error) return false;
   if (!validate_header()) {
     mmap_.unmap();
+    source_.unmap();
+    publish();
     return false;
   }
+  if (resident_) load_memory();
   return true;
 }
 
@@ -36,16 +216,18 @@ template <class T>
 bool disk_vector<T>::create(const path_type &path) noexcept {
   close();
   path_ = path;
+  read_only_ = false;
   std::error_code error;
   std::filesystem::create_directories(path_.parent_path(), error);
   if (error || !std::ofstream(path_, std::ios::binary | std::ios::trunc).good()) return false;
   std::filesystem::resize_file(path_, chunk_bytes_, error);
   if (error) return false;
-  mmap_.map(path_.string(), error);
+  map(error);
   if (error) return false;
   header().magic = kMagic;
   header().element_size = element_size();
   header().size = 0;
+  if (resident_) load_memory();
   return true;
 }
 
@@ -53,8 +235,8 @@ template <class T>
 open_code disk_vector<T>::open(const path_type &path, open_mode mode) noexcept {
   using enum open_mode;
   using enum open_code;
-  if (mode == kLoad) {
-    if (load(path)) return kLoadSuccess;
+  if (mode == kLoad || mode == kReadOnly) {
+    if (load(path, mode == kReadOnly)) return kLoadSuccess;
     return kOpenFailed;
   }
   if (mode == kCreate) {
@@ -62,54 +244,128 @@ open_code disk_vector<T>::open(const path_type &path, open_mode mode) noexcept {
     return kOpenFailed;
   }
   if (mode == kLoadOrCreate) {
-    if (load(path)) return kLoadSuccess;
+    if (load(path, false)) return kLoadSuccess;
     if (create(path)) return kCreateSuccess;
     return kOpenFailed;
   }
   return kOpenFailed;
 }
 
+template <class T>
+bool disk_vector<T>::attach(const char *image, size_type length) noexcept {
+  close();
+  path_.clear();
+  read_only_ = true;
+  if (!image || length < header_size()) return false;
+  view_ = image;
+  view_length_ = length;
+  publish();
+  if (!validate_header() || size_bytes() > length) {
+    view_ = nullptr;
+    view_length_ = 0;
+    publish();
+    return false;
+  }
+  set_advice(advice_);
+  if (populate_) prefetch(mapped_length());
+  if (resident_) load_memory();
+  return true;
+}
+
+template <class T>
+void disk_vector<T>::write_image_header(std::ostream &os, size_type count) {
+  header_t header{.magic = kMagic, .element_size = element_size(), .size = count};
+  os.write(reinterpret_cast<const char *>(&header), header_size());
+}
+
+template <class T>
+void disk_vector<T>::write_image(std::ostream &os, const_pointer first, size_type count) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  write_image_header(os, count);
+  if (count > 0) os.write(reinterpret_cast<const char *>(first), count * element_size());
+}
+
 template <class T>
 void disk_vector<T>::close() {
   if (!is_open()) return;
+  release_memory();
   sync();
   mmap_.unmap();
+  source_.unmap();
+  view_ = nullptr;
+  view_length_ = 0;
+  publish();
+  epoch_domain::global().collect();
 }
 
 template <class T>
-void disk_vector<T>::sync() {
-  if (!is_open()) return;
+void disk_vector<T>::sync(durability_mode mode) {
+  if (!is_open() || read_only_) return;
+  flush_memory();
+  if (mode == kSyncNone) return;
   std::error_code error;
-  mmap_.sync(error);
+  if (mode == kSyncFull) mmap_.sync(error);
+#if defined(_WIN32)
+  else if (::FlushViewOfFile(mmap_.data(), mmap_.mapped_length()) == 0) error = mio::detail::last_error();
+#else
+  else if (::msync(mmap_.data(), mmap_.mapped_length(), MS_ASYNC) != 0) error = mio::detail::last_error();
+#endif
   if (error) throw std::system_error(error);
 }
 
 template <class T>
 void disk_vector<T>::reserve(size_type new_capacity) {
+  if (read_only_) throw std::system_error(std::make_error_code(std::errc::read_only_file_system));
   if (new_capacity <= capacity()) return;
-  sync();
-  mmap_.unmap();
-  std::error_code error;
+  // Unflushed blocks reach the page cache first, which the new mapping shares.
+  flush_memory();
+  new_capacity = std::max(new_capacity, static_cast<size_type>(capacity() * growth_factor_));
   auto chunk_count = (header_size() + new_capacity * element_size() + chunk_bytes_ - 1) / chunk_bytes_;
-  std::filesystem::resize_file(path_, chunk_count * chunk_bytes_, error);
-  if (error) throw std::system_error(error);
-  mmap_.map(path_.string(), error);
-  if (error) throw std::system_error(error);
+  auto file_size = chunk_count * chunk_bytes_;
+
+  // Dirty pages stay in the page cache across the remap, so growing never needs an msync.
+  // The old mapping stays valid for pinned readers until the epoch domain reclaims it.
+  bool allocated = false;
+#if defined(__linux__)
+  allocated = ::posix_fallocate(mmap_.file_handle(), 0, static_cast<off_t>(file_size)) == 0;
+#elif defined(_WIN32)
+  LARGE_INTEGER extent{.QuadPart = static_cast<LONGLONG>(file_size)};
+  if (auto section = ::CreateFileMappingW(mmap_.file_handle(), nullptr, PAGE_READWRITE, extent.HighPart,
+                                          extent.LowPart, nullptr)) {
+    ::CloseHandle(section);
+    allocated = true;
+  }
+#endif
+  std::error_code error;
+  if (!allocated) {
+    std::filesystem::resize_file(path_, file_size, error);
+    if (error) throw std::system_error(error);
+  }
+  auto retired = std::make_shared<mio::mmap_sink>(std::move(mmap_));
+  map(error);
+  if (error) {
+    mmap_ = std::move(*retired);
+    throw std::system_error(error);
+  }
+  epoch_domain::global().retire([retired] { retired->unmap(); });
+  if (resident_) load_memory();
 }
 
 template <class T>
 void disk_vector<T>::resize(size_type new_size) {
-  if (new_size > size()) {
+  if (read_only_) throw std::system_error(std::make_error_code(std::errc::read_only_file_system));
+  auto old_size = size();
+  if (new_size > old_size) {
     reserve(new_size);
-    for (iterator it = data() + size(); it != data() + new_size; ++it) std::construct_at(it);
-  } else for (iterator it = data() + new_size; it != data() + size(); ++it) std::destroy_at(it);
+    std::uninitialized_value_construct_n(mutable_data(old_size, new_size - old_size), new_size - old_size);
+  } else std::destroy_n(mutable_data(new_size, old_size - new_size), old_size - new_size);
   header().size = new_size;
 }
 
 template <class T>
 auto disk_vector<T>::push_back(const_reference value) -> reference {
   reserve(size() + 1);
-  std::construct_at(data() + size(), value);
+  std::construct_at(mutable_data(size(), 1), value);
   ++header().size;
   return back();
 }
@@ -117,7 +373,7 @@ auto disk_vector<T>::push_back(const_reference value) -> reference {
 template <class T>
 auto disk_vector<T>::push_back(value_type &&value) -> reference {
   reserve(size() + 1);
-  std::construct_at(data() + size(), std::move(value));
+  std::construct_at(mutable_data(size(), 1), std::move(value));
   ++header().size;
   return back();
 }
@@ -126,7 +382,7 @@ template <class T>
 template <class... Args>
 auto disk_vector<T>::emplace_back(Args &&... args) -> reference {
   reserve(size() + 1);
-  std::construct_at(data() + size(), std::forward<Args>(args)...);
+  std::construct_at(mutable_data(size(), 1), std::forward<Args>(args)...);
   ++header().size;
   return back();
 }
@@ -134,7 +390,7 @@ auto disk_vector<T>::emplace_back(Args &&... args) -> reference {
 template <class T>
 auto disk_vector<T>::append(const_reference value) -> disk_vector & {
   reserve(size() + 1);
-  std::construct_at(data() + size(), value);
+  std::construct_at(mutable_data(size(), 1), value);
   ++header().size;
   return *this;
 }
@@ -142,7 +398,7 @@ auto disk_vector<T>::append(const_reference value) -> disk_vector & {
 template <class T>
 auto disk_vector<T>::append(value_type &&value) -> disk_vector & {
   reserve(size() + 1);
-  std::construct_at(data() + size(), std::move(value));
+  std::construct_at(mutable_data(size(), 1), std::move(value));
   ++header().size;
   return *this;
 }
@@ -153,8 +409,8 @@ auto disk_vector<T>::append(It first, It last) -> disk_vector & {
   auto count = std::distance(first, last);
   reserve(size() + count);
   if constexpr (std::is_trivially_copyable_v<T> && std::contiguous_iterator<It>)
-    std::memcpy(data() + size(), std::to_address(first), count * element_size());
-  else for (iterator it = data() + size(); first != last; ++it, ++first) std::construct_at(it, *first);
+    std::memcpy(mutable_data(size(), count), std::to_address(first), count * element_size());
+  else for (iterator it = mutable_data(size(), count); first != last; ++it, ++first) std::construct_at(it, *first);
   header().size += count;
   return *this;
 }
@@ -1,4 +1,10 @@
 #pragma once
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <utility>
 
 template <class Char, class Traits>
 basic_string_pool_iterator<Char, Traits>::basic_string_pool_iterator(const char_type *data, const char_type *begin)
@@ -42,25 +48,174 @@ auto basic_string_pool_iterator<Char, Traits>::handle() const noexcept -> handle
 
 template <class Char, bool NullTerminated, class Traits>
 basic_string_pool_base<Char, NullTerminated, Traits>::basic_string_pool_base(
-  const path_type &path, open_mode mode, size_type chunk_bytes) noexcept : pool_(path, mode, chunk_bytes) {}
+  const path_type &path, open_mode mode, size_type chunk_bytes) noexcept : pool_(chunk_bytes) {
+  open(path, mode);
+}
 
 template <class Char, bool NullTerminated, class Traits>
 open_code basic_string_pool_base<Char, NullTerminated, Traits>::open(const path_type &path, open_mode mode) noexcept {
-  return pool_.open(path, mode);
+  close();
+  auto code = pool_.open(path, mode);
+  if (code == open_code::kLoadSuccess) load_codec();
+  return code;
+}
+
+template <class Char, bool NullTerminated, class Traits>
+bool basic_string_pool_base<Char, NullTerminated, Traits>::attach(const char *image, size_type length) noexcept {
+  close();
+  if (!pool_.attach(image, length)) return false;
+  load_codec();
+  return true;
+}
+
+template <class Char, bool NullTerminated, class Traits>
+void basic_string_pool_base<Char, NullTerminated, Traits>::close() {
+  pool_.close();
+  codec_.reset();
+  std::lock_guard lock(cache_mutex_);
+  retire_cache();
+}
+
+template <class Char, bool NullTerminated, class Traits>
+void basic_string_pool_base<Char, NullTerminated, Traits>::load_codec() noexcept {
+  if constexpr (kCompressible) {
+    symbol_codec::table_t table;
+    if (pool_.size() < sizeof(table)) return;
+    std::memcpy(&table, std::as_const(pool_).data(), sizeof(table));
+    if (symbol_codec::valid(table)) codec_ = std::make_unique<symbol_codec>(table);
+  }
+}
+
+template <class Char, bool NullTerminated, class Traits>
+void basic_string_pool_base<Char, NullTerminated, Traits>::set_compressed(bool compressed) {
+  if (compressed == this->compressed()) return;
+  if (pool_.size() != 0 || (compressed && !kCompressible))
+    throw std::system_error(std::make_error_code(std::errc::operation_not_permitted));
+  if constexpr (kCompressible) {
+    if (!compressed) return codec_.reset();
+    codec_ = std::make_unique<symbol_codec>();
+    const auto *table = reinterpret_cast<const char *>(&codec_->table());
+    pool_.append(table, table + sizeof(symbol_codec::table_t));
+  }
+}
+
+template <class Char, bool NullTerminated, class Traits>
+void basic_string_pool_base<Char, NullTerminated, Traits>::resize(size_type size) {
+  if (size < pool_.size()) {
+    std::lock_guard lock(cache_mutex_);
+    retire_cache();
+  }
+  pool_.resize(size);
+}
+
+template <class Char, bool NullTerminated, class Traits>
+void basic_string_pool_base<Char, NullTerminated, Traits>::clear() {
+  bool compressed = this->compressed();
+  pool_.clear();
+  codec_.reset();
+  {
+    std::lock_guard lock(cache_mutex_);
+    retire_cache();
+  }
+  set_compressed(compressed);
 }
 
 template <class Char, bool NullTerminated, class Traits>
 auto basic_string_pool_base<Char, NullTerminated, Traits>::get(
   handle_type::offset_type offset, handle_type::length_type length) const noexcept -> view_type {
+  if constexpr (kCompressible)
+    if (codec_) return decoded(offset, length);
   return view_type(pool_.data() + offset, length);
 }
 
+template <class Char, bool NullTerminated, class Traits>
+auto basic_string_pool_base<Char, NullTerminated, Traits>::get(
+  handle_type handle, std::basic_string<char_type, traits_type> &buffer) const -> view_type {
+  if constexpr (kCompressible) {
+    if (codec_) {
+      const auto *end = codes_end(handle.offset, handle.length);
+      buffer.resize(handle.length + symbol_codec::kMaxSymbolLength);
+      auto decoded = handle.offset <= pool_.size()
+        && codec_->decode(pool_.data() + handle.offset, end, buffer.data(), handle.length);
+      buffer.resize(decoded ? handle.length : 0);
+      return buffer;
+    }
+  }
+  return get(handle);
+}
+
+template <class Char, bool NullTerminated, class Traits>
+auto basic_string_pool_base<Char, NullTerminated, Traits>::codes_end(
+  handle_type::offset_type offset, handle_type::length_type length) const noexcept -> const char_type * {
+  auto size = pool_.size();
+  return pool_.data() + std::min<size_type>(size, offset + symbol_codec::max_encoded_length(length));
+}
+
+template <class Char, bool NullTerminated, class Traits>
+auto basic_string_pool_base<Char, NullTerminated, Traits>::decoded(
+  handle_type::offset_type offset, handle_type::length_type length) const noexcept -> view_type {
+  if (length == 0 || offset >= pool_.size()) return {};
+  auto key = std::uint64_t(offset) << kCacheLengthBits | length;
+  auto slot = key * 0x9e3779b97f4a7c15ull >> (64 - kCacheSlotBits);
+  {
+    std::shared_lock lock(cache_mutex_);
+    if (cache_ && cache_->strings[slot] && cache_->keys[slot] == key) return view_type(cache_->strings[slot], length);
+  }
+  char_type buffer[(std::size_t(1) << kCacheLengthBits) + symbol_codec::kMaxSymbolLength];
+  if (!codec_->decode(pool_.data() + offset, codes_end(offset, length), buffer, length)) return {};
+
+  std::lock_guard lock(cache_mutex_);
+  if (!cache_ || cache_->used + length > kCacheBytes) {
+    auto *arena = new (std::nothrow) cache_arena;
+    if (!arena) return {};
+    try {
+      retire_cache();
+    } catch (const std::bad_alloc &) {
+      delete arena;
+      return {};
+    }
+    cache_ = arena;
+  }
+  auto *str = cache_->bytes + cache_->used;
+  std::memcpy(str, buffer, length * sizeof(char_type));
+  cache_->used += length;
+  cache_->keys[slot] = key;
+  cache_->strings[slot] = str;
+  return view_type(str, length);
+}
+
+template <class Char, bool NullTerminated, class Traits>
+void basic_string_pool_base<Char, NullTerminated, Traits>::retire_cache() const {
+  if (!cache_) return;
+  epoch_domain::global().retire([arena = cache_] { delete arena; });
+  cache_ = nullptr;
+}
+
+template <class Char, bool NullTerminated, class Traits>
+bool basic_string_pool_base<Char, NullTerminated, Traits>::equal(
+  handle_type::offset_type offset, handle_type::length_type length, view_type view) const noexcept {
+  if (length != view.size()) return false;
+  if constexpr (kCompressible) {
+    if (codec_) return offset <= pool_.size() && codec_->equal(pool_.data() + offset, codes_end(offset, length), view);
+  }
+  return view_type(pool_.data() + offset, length) == view;
+}
+
 template <class Char, bool NullTerminated, class Traits>
 auto basic_string_pool_base<Char, NullTerminated, Traits>::add(view_type view) -> handle_type {
   handle_type handle{
     .offset = static_cast<handle_type::offset_type>(pool_.size()),
     .length = static_cast<handle_type::length_type>(view.length())
   };
+  if constexpr (kCompressible) {
+    if (codec_) {
+      auto size = pool_.size();
+      auto max_length = symbol_codec::max_encoded_length(view.size());
+      pool_.resize(size + max_length);
+      pool_.resize(size + codec_->encode(view, pool_.mutable_data(size, max_length)));
+      return handle;
+    }
+  }
   pool_.append(view.begin(), view.end());
   if constexpr (NullTerminated) pool_.append(null);
   return handle;
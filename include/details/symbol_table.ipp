@@ -46,18 +46,38 @@ template <class Id, class Char, class Traits>
 open_code basic_symbol_table<Id, Char, Traits>::open(const path_type &path, open_mode mode,
                                                      std::initializer_list<view_type> symbols) noexcept {
   close();
+  reserve_ids();
   auto code = symbols_.open(path, mode);
   if (code == open_code::kCreateSuccess) for (auto symbol : symbols) add(symbol);
-  if (code == open_code::kLoadSuccess)
-    for (auto it = symbols_.begin(); it != symbols_.end(); ++it) {
-      auto handle = it.handle();
-      id_type id = id_to_symbol_.size();
-      id_to_symbol_.emplace_back(handle);
-      symbol_to_id_.emplace(handle, id);
-    }
+  if (code == open_code::kLoadSuccess) load_symbols();
   return code;
 }
 
+template <class Id, class Char, class Traits>
+bool basic_symbol_table<Id, Char, Traits>::attach(const char *image, size_type length) noexcept {
+  close();
+  reserve_ids();
+  if (!symbols_.attach(image, length)) return false;
+  load_symbols();
+  return true;
+}
+
+template <class Id, class Char, class Traits>
+void basic_symbol_table<Id, Char, Traits>::reserve_ids() {
+  // Snapshot readers index id_to_symbol_ while the writer adds symbols, so it must never reallocate.
+  if constexpr (sizeof(id_type) <= 2) id_to_symbol_.reserve(std::size_t(1) << 8 * sizeof(id_type));
+}
+
+template <class Id, class Char, class Traits>
+void basic_symbol_table<Id, Char, Traits>::load_symbols() {
+  for (auto it = std::as_const(symbols_).begin(); it != std::as_const(symbols_).end(); ++it) {
+    auto handle = it.handle();
+    id_type id = id_to_symbol_.size();
+    id_to_symbol_.emplace_back(handle);
+    symbol_to_id_.emplace(handle, id);
+  }
+}
+
 template <class Id, class Char, class Traits>
 void basic_symbol_table<Id, Char, Traits>::close() {
   symbols_.close();
@@ -82,3 +102,24 @@ auto basic_symbol_table<Id, Char, Traits>::add(view_type symbol) -> id_type {
   symbol_to_id_.emplace(handle, id);
   return id;
 }
+
+template <class Id, class Char, class Traits>
+void basic_symbol_table<Id, Char, Traits>::truncate(size_type count) {
+  if (count >= size()) return;
+  for (auto id = count; id < size(); ++id) symbol_to_id_.erase(id_to_symbol_[id]);
+  symbols_.resize(id_to_symbol_[count].offset);
+  id_to_symbol_.resize(count);
+}
+
+template <class Id, class Char, class Traits>
+auto basic_symbol_table<Id, Char, Traits>::symbol_bytes(size_type count) const noexcept -> size_type {
+  // Only reads handles below count, so a concurrent add() never races with it.
+  if (count == 0) return 0;
+  const auto &last = id_to_symbol_[count - 1];
+  return last.offset + last.length + 1;
+}
+
+template <class Id, class Char, class Traits>
+void basic_symbol_table<Id, Char, Traits>::write_image(std::ostream &os, size_type count) const {
+  symbols_.write_image(os, count < size() ? id_to_symbol_[count].offset : symbols_.size());
+}
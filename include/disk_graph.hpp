@@ -1,19 +1,69 @@
 #pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <filesystem>
 #include <initializer_list>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <span>
+#include <stop_token>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 #include "config.hpp"
+#include "disk_hash_index.hpp"
 #include "disk_vector.hpp"
+#include "epoch.hpp"
 #include "graph_view.hpp"
-#include "string_map.hpp"
 #include "string_pool.hpp"
 #include "symbol_table.hpp"
 
+struct CorruptBlock {
+  std::string_view file;
+  std::size_t offset;
+  std::size_t length;
+};
+
+struct VerifyReport {
+  verify_state state = kVerifyPending;
+  std::size_t verified_blocks = 0;
+  std::vector<CorruptBlock> corrupt_blocks;
+};
+
+struct SourceFile {
+  std::uint64_t path_hash = 0;
+  std::size_t size = 0;
+  std::int64_t mtime = 0;
+  std::uint64_t content_hash = 0;
+  // Tombstone count when recorded; a plain load may only skip the file while no version has been tombstoned since.
+  std::size_t tombstone_count = 0;
+  // Recorded as the contents of the repository named by the path, which keeps its versions live.
+  bool repository = false;
+
+  bool operator==(const SourceFile &) const = default;
+};
+
+struct GraphStats {
+  std::size_t sequence = 0;
+  std::size_t package_count = 0;
+  std::size_t version_count = 0;
+  std::size_t dependency_count = 0;
+  std::size_t tombstone_count = 0;
+  std::size_t file_bytes = 0;
+  double resident_fraction = 0.0;
+  VerifyReport verification;
+};
+
 class DiskGraph {
 public:
+  class Snapshot;
+
   DiskGraph(std::size_t chunk_bytes = kDefaultChunkBytes) noexcept;
   DiskGraph(const std::filesystem::path &directory_path, open_mode mode = open_mode::kLoadOrCreate,
             std::initializer_list<std::string_view> architectures = {},
@@ -25,20 +75,79 @@ public:
                  std::initializer_list<std::string_view> architectures = {},
                  std::initializer_list<std::string_view> dependency_types = {}) noexcept;
   void close();
-  void sync();
+  void sync() { commit(durability_); }
+  void sync(durability_mode mode) { commit(mode); }
+  void commit() { commit(durability_); }
+  void commit(durability_mode mode);
+
+  void export_packed(const std::filesystem::path &file_path, std::size_t alignment = kDefaultPackedAlignment) const;
+  bool packed() const noexcept { return packed_.is_open(); }
+
+  // Rewrites the graph without tombstoned versions into a sibling directory and swaps it in. Ids change, so it waits
+  // for pinned snapshots to be released, and no new one may be taken until it returns.
+  void compact();
 
   bool is_open() const noexcept { return control_.is_open(); }
   operator bool() const noexcept { return is_open(); }
+  bool read_only() const noexcept { return control_.read_only(); }
 
   std::size_t chunk_bytes() const noexcept { return package_nodes_.chunk_bytes(); }
   void set_chunk_bytes(std::size_t chunk_bytes) noexcept;
 
-  std::size_t architecture_count() const noexcept { return architectures_.size(); }
-  std::size_t dependency_type_count() const noexcept { return dependency_types_.size(); }
+  double growth_factor() const noexcept { return package_nodes_.growth_factor(); }
+  void set_growth_factor(double growth_factor) noexcept;
+
+  durability_mode durability() const noexcept { return durability_; }
+  void set_durability(durability_mode durability) noexcept;
+
+  bool populate() const noexcept { return package_nodes_.populate(); }
+  void set_populate(bool populate) noexcept;
+
+  bool memory_resident() const noexcept { return package_nodes_.resident(); }
+  void set_memory_resident(bool resident) noexcept;
+
+  std::size_t warmup(std::size_t budget_bytes);
+  double resident_fraction() const noexcept;
+
+  std::size_t ingest_threads() const noexcept { return ingest_threads_; }
+  void set_ingest_threads(std::size_t ingest_threads) noexcept { ingest_threads_ = ingest_threads; }
 
-  std::size_t package_count() const noexcept { return package_nodes_.size(); }
-  std::size_t version_count() const noexcept { return version_nodes_.size(); }
-  std::size_t dependency_count() const noexcept { return dependency_edges_.size(); }
+  bool background_verify() const noexcept { return background_verify_; }
+  void set_background_verify(bool background_verify) noexcept { background_verify_ = background_verify; }
+
+  bool verify() { return verify(std::stop_token()); }
+  GraphStats stats() const;
+
+  // A read-only graph ends at its last commit and ignores whatever a writer appended after it.
+  std::size_t architecture_count() const noexcept {
+    return read_only() ? control().architecture_count : architectures_.size();
+  }
+  std::size_t dependency_type_count() const noexcept {
+    return read_only() ? control().dependency_type_count : dependency_types_.size();
+  }
+
+  std::size_t package_count() const noexcept { return read_only() ? control().package_count : package_nodes_.size(); }
+  std::size_t version_count() const noexcept { return read_only() ? control().version_count : version_nodes_.size(); }
+  std::size_t dependency_count() const noexcept {
+    return read_only() ? control().dependency_count : dependency_edges_.size();
+  }
+  std::size_t tombstone_count() const noexcept;
+
+  // A writer sees its tombstones as soon as they are logged; a snapshot, like a read-only graph, only sees those of
+  // the commits it covers.
+  bool tombstoned(VersionId vid) const noexcept {
+    return tombstoned_at(vid, read_only() ? control().sequence : kLatestSequence);
+  }
+  bool tombstoned(VersionId vid, const Snapshot &snapshot) const noexcept;
+
+  bool strings_interned() const noexcept { return control().flags & kInternedStringsFlag; }
+
+  // Applies to graphs created afterwards; an opened graph reports how its string pool is stored. Views decoded from a
+  // compressed pool own their strings, since its bounded decode cache is retired as it fills.
+  bool compressed_strings() const noexcept { return is_open() ? string_pool_.compressed() : compressed_strings_; }
+  void set_compressed_strings(bool compressed) noexcept { compressed_strings_ = compressed; }
+
+  Snapshot snapshot() const;
 
   const symbol_table<ArchitectureType> &architectures() const noexcept { return architectures_; }
   const symbol_table<DependencyType> &dependency_types() const noexcept { return dependency_types_; }
@@ -49,10 +158,25 @@ public:
 
   std::optional<PackageView> get_package(std::string_view name) const noexcept;
 
-  ArchitectureType add_architecture(std::string_view arch) noexcept;
-  DependencyType add_dependency_type(std::string_view dtype) noexcept;
+  ArchitectureType add_architecture(std::string_view arch);
+  DependencyType add_dependency_type(std::string_view dtype);
+
+  // Maps every buffer version to its disk version, whether it was appended or already present. A version whose
+  // stanza changed under the same package, version and architecture is tombstoned and appended again.
+  void ingest(const BufferGraph &bgraph, std::span<VersionId> version_ids = {});
 
-  void ingest(const BufferGraph &bgraph);
+  // Makes version_ids the complete contents of the named repository. Versions it listed before and no longer lists
+  // are tombstoned unless another repository still lists them; a version added again later gets a new id.
+  void replace_repository(std::string_view name, std::vector<VersionId> version_ids);
+  bool has_repository(std::string_view name) const;
+
+  // Content hashes of loaded files and stanzas let reloads skip input the graph already holds. The stanza index is
+  // a cache: recovery and compaction drop it and the next load fills it again. A stanza found by its hash must also
+  // name the version's package, version and architecture.
+  std::optional<SourceFile> find_source(std::uint64_t path_hash) const;
+  void record_source(const SourceFile &source);
+  std::optional<VersionId> find_stanza(std::uint64_t content_hash, std::string_view package, std::string_view version,
+                                       std::string_view architecture) const;
 
 private:
   friend class DependencyGraph;
@@ -61,6 +185,14 @@ private:
   struct VersionNode;
   struct DependencyEdge;
   struct VersionList;
+  struct VersionKey;
+  struct JournalEntry;
+  struct RepositoryEntry;
+  struct TombstoneEntry;
+  struct SourceEntry;
+  struct StanzaKey;
+  struct IngestPartition;
+  struct BlockChecksums;
 
   disk_vector<std::byte> control_;
   symbol_table<ArchitectureType> architectures_;
@@ -69,8 +201,35 @@ private:
   disk_vector<VersionNode> version_nodes_;
   disk_vector<DependencyEdge> dependency_edges_;
   disk_vector<VersionList> version_lists_;
+  disk_vector<PackageId> version_packages_;
+  disk_vector<JournalEntry> journal_;
   string_pool<> string_pool_;
-  string_handle_map<PackageId> name_to_package_id_;
+  disk_hash_index<string_handle> string_index_;
+  bool string_index_stale_ = false;
+  disk_hash_index<PackageId> name_index_;
+  disk_hash_index<VersionKey> version_index_;
+  disk_vector<BlockChecksums> checksums_;
+  disk_vector<RepositoryEntry> repositories_;
+  disk_vector<VersionId> repository_versions_;
+  disk_vector<TombstoneEntry> tombstone_log_;
+  disk_vector<std::uint64_t> tombstones_;
+  disk_vector<SourceEntry> sources_;
+  std::unordered_map<std::uint64_t, std::size_t> source_index_;
+  disk_hash_index<StanzaKey> stanza_index_;
+  std::filesystem::path directory_;
+  mio::mmap_source packed_;
+  durability_mode durability_ = kSyncFull;
+  std::atomic<std::size_t> active_control_ = 0;
+  // Tombstone log entries a reader may scan; set before the bits of the entries it covers.
+  std::atomic<std::size_t> logged_tombstones_ = 0;
+  bool dirty_ = false;
+  std::size_t ingest_threads_;
+  bool background_verify_ = true;
+  bool compressed_strings_ = false;
+  mutable std::mutex checksum_mutex_;
+  std::mutex verify_mutex_;
+  VerifyReport verify_report_;
+  std::jthread verifier_;
 
   using VersionCountType = std::uint16_t;
   using DependencyCountType = std::uint16_t;
@@ -106,6 +265,91 @@ private:
     VersionListId next_version_list_id;
   };
 
+  struct VersionKey {
+    PackageId package_id;
+    VersionId version_id;
+  };
+
+  struct JournalEntry {
+    std::size_t sequence;
+    PackageId package_id;
+    VersionListId version_list_id;
+  };
+
+  // Repository and tombstone logs are append-only and tagged with the sequence of the commit that publishes them.
+  // The latest entry per name_hash is the repository's current, sorted membership.
+  struct RepositoryEntry {
+    std::size_t sequence;
+    std::uint64_t name_hash;
+    std::size_t version_begin;
+    std::size_t version_count;
+  };
+
+  struct TombstoneEntry {
+    std::size_t sequence;
+    VersionId version_id;
+  };
+
+  struct SourceEntry {
+    std::size_t sequence;
+    SourceFile source;
+  };
+
+  struct StanzaKey {
+    std::uint64_t content_hash;
+    VersionId version_id;
+  };
+
+  enum ChecksumSection : std::size_t {
+    kChecksumArchitectures,
+    kChecksumDependencyTypes,
+    kChecksumPackages,
+    kChecksumVersions,
+    kChecksumDependencies,
+    kChecksumVersionLists,
+    kChecksumVersionPackages,
+    kChecksumStringPool,
+    kChecksumSectionCount
+  };
+
+  struct BlockChecksums {
+    std::uint32_t crc[kChecksumSectionCount];
+  };
+
+  enum PackedSectionKind : std::size_t {
+    kPackedControl,
+    kPackedArchitectures,
+    kPackedDependencyTypes,
+    kPackedPackages,
+    kPackedVersions,
+    kPackedDependencies,
+    kPackedVersionLists,
+    kPackedVersionPackages,
+    kPackedJournal,
+    kPackedStringPool,
+    kPackedNameIndex,
+    kPackedVersionIndex,
+    kPackedRepositories,
+    kPackedRepositoryVersions,
+    kPackedTombstoneLog,
+    kPackedTombstones,
+    kPackedSources,
+    kPackedSectionCount
+  };
+
+  struct PackedHeader {
+    std::size_t magic;
+    std::size_t version;
+    std::size_t alignment;
+    std::size_t section_count;
+  };
+
+  struct PackedSection {
+    std::size_t kind;
+    std::size_t offset;
+    std::size_t length;
+  };
+
   struct Control {
     std::size_t magic;
     std::size_t architecture_count;
@@ -115,27 +359,133 @@ private:
     std::size_t dependency_count;
     std::size_t version_list_count;
     std::size_t string_pool_size;
+    std::size_t flags;
+    std::size_t sequence;
+    std::size_t checksum;
   };
 
   constexpr static VersionListId kVersionListEndId = static_cast<VersionListId>(-1);
   constexpr static std::size_t kMagicNumber = 0x485052474b534944; // "DISKGRPH"
+  constexpr static std::size_t kLegacyControlSize = offsetof(Control, flags);
+  constexpr static std::size_t kControlSlotCount = 2;
+  constexpr static std::size_t kMinIngestPartitionVersions = 4096;
+  constexpr static std::size_t kInternedStringsFlag = 1;
+  constexpr static std::size_t kCompressedStringsFlag = 2;
+  constexpr static std::size_t kPackedMagic = 0x44454b4341504744; // "DGPACKED"
+  constexpr static std::size_t kPackedVersion = 3;
+  constexpr static std::size_t kChecksumBlockBytes = 64 * KiB;
+  constexpr static std::size_t kCompactionBatchDependencies = 1 << 20;
+  constexpr static VersionId kInvalidVersionId = static_cast<VersionId>(-1);
+  constexpr static std::size_t kLatestSequence = static_cast<std::size_t>(-1);
+  constexpr static std::array<std::string_view, kChecksumSectionCount> kChecksumFiles{
+    "architectures.dat", "dependency-types.dat", "packages.dat", "versions.dat", "dependencies.dat",
+    "version-lists.dat", "version-packages.dat", "string-pool.dat"
+  };
 
   static std::size_t control_size() noexcept { return sizeof(Control); }
 
-  Control &control() noexcept { return *reinterpret_cast<Control *>(control_.data()); }
-  const Control &control() const noexcept { return *reinterpret_cast<const Control *>(control_.data()); }
+  const Control &control_slot(std::size_t slot) const noexcept {
+    return reinterpret_cast<const Control *>(control_.data())[slot];
+  }
+  Control &mutable_control_slot(std::size_t slot) {
+    return *reinterpret_cast<Control *>(control_.mutable_data(slot * control_size(), control_size()));
+  }
+  const Control &control() const noexcept { return control_slot(active_control_); }
 
+  static std::size_t control_checksum(const Control &control) noexcept;
+  static bool valid_control(const Control &control) noexcept;
+  bool select_control() noexcept;
+  Control current_control() const noexcept;
+  void write_control();
   bool validate_control() const noexcept;
+  bool has_uncommitted_tail() const noexcept;
+  void recover();
+
+  template <class Log>
+  static std::size_t committed_size(const Log &log, std::size_t sequence) noexcept;
+  template <class Log>
+  std::size_t visible_size(const Log &log) const noexcept;
+  std::vector<std::size_t> current_repositories() const;
+  bool tombstoned_at(VersionId vid, std::size_t sequence) const noexcept;
+  void tombstone(const std::vector<VersionId> &version_ids);
+  void rebuild_tombstones();
+  void rebuild_source_index();
+
+  // Sidecar CRC32C per kChecksumBlockBytes of every data file, covering exactly the committed bytes. Commits
+  // rewrite the blocks from the previous committed end on plus package blocks whose heads were journaled.
+  using ChecksumSections = std::array<std::span<const std::byte>, kChecksumSectionCount>;
+  ChecksumSections checksum_sections(const Control &control) const noexcept;
+  std::uint32_t committed_block_checksum(ChecksumSection section, std::span<const std::byte> block,
+                                         std::size_t offset, const Control &committed) const;
+  void update_checksums(const Control &previous, const Control &next);
+  bool verify(std::stop_token stop);
+  void start_verifier() noexcept;
 
-  bool load(const std::filesystem::path &directory_path) noexcept;
+  // Compaction builds the new graph in the staging directory and moves the old one to the retired directory while
+  // swapping them.
+  static std::filesystem::path staging_path(const std::filesystem::path &directory_path);
+  static std::filesystem::path retired_path(const std::filesystem::path &directory_path);
+
+  bool load(const std::filesystem::path &directory_path, bool read_only) noexcept;
+  bool load_packed(const std::filesystem::path &file_path) noexcept;
   bool create(const std::filesystem::path &directory_path, std::initializer_list<std::string_view> architectures,
               std::initializer_list<std::string_view> dependency_types) noexcept;
 
-  std::pair<PackageId, bool> create_package(std::string_view name);
-  std::pair<VersionId, bool> create_version(PackageId pid, std::string_view version, ArchitectureType arch,
-                                            DependencyId did_begin, DependencyCountType dcount);
-  std::pair<DependencyId, bool> create_dependency(VersionId from_vid, PackageId to_pid, std::string_view vcons,
-                                                  ArchitectureType acons, DependencyType dtype, GroupId gid);
+  // Views a pool string, or a decoded copy kept in storage when the pool is compressed.
+  std::string_view view_string(string_handle_offset_t offset, string_handle_length_t length,
+                               std::shared_ptr<const std::string> &storage) const;
+
+  std::optional<PackageId> find_package(std::string_view name, std::uint64_t hash) const {
+    return find_package(name, hash, package_count());
+  }
+  std::optional<PackageId> find_package(std::string_view name, std::uint64_t hash, std::size_t package_limit) const;
+  void rebuild_name_index();
+
+  static std::uint64_t version_hash(PackageId pid, std::uint64_t version_hash, ArchitectureType arch) noexcept;
+  static std::uint64_t version_hash(PackageId pid, std::string_view version, ArchitectureType arch) noexcept {
+    return version_hash(pid, stable_hash(version), arch);
+  }
+  std::optional<VersionId> find_version(PackageId pid, std::string_view version, ArchitectureType arch) const {
+    return find_version(pid, version, arch, version_count(), read_only() ? control().sequence : kLatestSequence);
+  }
+  std::optional<VersionId> find_version(PackageId pid, std::string_view version, ArchitectureType arch,
+                                        const Snapshot &snapshot) const;
+  std::optional<VersionId> find_version(PackageId pid, std::string_view version, ArchitectureType arch,
+                                        std::size_t version_limit, std::size_t sequence) const;
+  VersionListId version_list_head(PackageId pid, const Snapshot &snapshot) const noexcept;
+  void rebuild_version_index();
+  void rebuild_version_packages();
+
+  std::optional<string_handle> find_string(std::string_view str, std::uint64_t hash) const;
+  string_handle intern_string(std::string_view str, std::uint64_t hash);
+  void rebuild_string_index();
+
+  void attach_versions(VersionId vid_begin, const std::vector<std::pair<PackageId, std::size_t>> &attachments);
+  bool same_dependencies(VersionId vid, const BufferGraph &bgraph, VersionId bvid,
+                         const std::vector<PackageId> &pids) const;
+};
+
+// Pins the counts of one committed flush together with the mappings they were read from. A writer may keep
+// appending and remapping; everything reachable within these counts stays valid until the snapshot is released.
+class DiskGraph::Snapshot {
+public:
+  Snapshot() noexcept = default;
+
+  bool valid() const noexcept { return guard_.active(); }
+  void release() noexcept { guard_.release(); }
+
+  std::size_t sequence() const noexcept { return control_.sequence; }
+  std::size_t architecture_count() const noexcept { return control_.architecture_count; }
+  std::size_t dependency_type_count() const noexcept { return control_.dependency_type_count; }
+  std::size_t package_count() const noexcept { return control_.package_count; }
+  std::size_t version_count() const noexcept { return control_.version_count; }
+  std::size_t dependency_count() const noexcept { return control_.dependency_count; }
+  std::size_t version_list_count() const noexcept { return control_.version_list_count; }
+  bool strings_interned() const noexcept { return control_.flags & kInternedStringsFlag; }
+
+private:
+  friend class DiskGraph;
 
-  void attach_versions(PackageId pid, VersionId vid_begin, VersionCountType vcount);
+  epoch_guard guard_;
+  Control control_{};
 };
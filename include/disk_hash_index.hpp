@@ -0,0 +1,195 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include "config.hpp"
+#include "disk_vector.hpp"
+
+constexpr std::uint64_t stable_hash(std::string_view sv, std::uint64_t seed = 0xcbf29ce484222325ull) noexcept {
+  for (auto c : sv) seed = (seed ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+  return seed;
+}
+
+constexpr std::uint64_t stable_hash_combine(std::uint64_t seed, std::uint64_t value) noexcept {
+  return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
+
+// MurmurHash3-style word-at-a-time hash for whole files and stanzas, where stable_hash would be the bottleneck. The
+// text may be fed in pieces of any length, as long as its total size is known up front.
+class content_hasher {
+public:
+  explicit content_hasher(std::size_t size, std::uint64_t seed = 0x9e3779b97f4a7c15ull) noexcept
+    : hash_(seed ^ size) {}
+
+  void update(std::string_view sv) noexcept {
+    const auto *data = sv.data();
+    auto length = sv.size();
+    if (pending_length_ > 0) {
+      auto count = std::min(length, sizeof(std::uint64_t) - pending_length_);
+      std::memcpy(pending_ + pending_length_, data, count);
+      pending_length_ += count;
+      data += count;
+      length -= count;
+      if (pending_length_ < sizeof(std::uint64_t)) return;
+      round(pending_);
+      pending_length_ = 0;
+    }
+    for (; length >= sizeof(std::uint64_t); data += sizeof(std::uint64_t), length -= sizeof(std::uint64_t))
+      round(data);
+    if (length) std::memcpy(pending_, data, length);
+    pending_length_ = length;
+  }
+
+  std::uint64_t finish() const noexcept {
+    std::uint64_t tail = 0;
+    if (pending_length_) std::memcpy(&tail, pending_, pending_length_);
+    auto hash = hash_ ^ std::rotl(tail * kMul1, 31) * kMul2;
+    hash = (hash ^ hash >> 33) * 0xff51afd7ed558ccdull;
+    hash = (hash ^ hash >> 33) * 0xc4ceb9fe1a85ec53ull;
+    return hash ^ hash >> 33;
+  }
+
+private:
+  static constexpr std::uint64_t kMul1 = 0x87c37b91114253d5ull, kMul2 = 0x4cf5ad432745937full;
+
+  std::uint64_t hash_;
+  char pending_[sizeof(std::uint64_t)];
+  std::size_t pending_length_ = 0;
+
+  void round(const char *data) noexcept {
+    std::uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    hash_ ^= std::rotl(word * kMul1, 31) * kMul2;
+    hash_ = std::rotl(hash_, 27) * 5 + 0x52dce729;
+  }
+};
+
+inline std::uint64_t content_hash(std::string_view sv, std::uint64_t seed = 0x9e3779b97f4a7c15ull) noexcept {
+  content_hasher hasher(sv.size(), seed);
+  hasher.update(sv);
+  return hasher.finish();
+}
+
+template <class Key>
+class disk_hash_index {
+public:
+  using key_type = Key;
+  using hash_type = std::uint32_t;
+  using size_type = std::size_t;
+  using path_type = std::filesystem::path;
+
+  disk_hash_index(size_type chunk_bytes = kDefaultChunkBytes) noexcept : table_(chunk_bytes) {}
+  disk_hash_index(const path_type &path, open_mode mode = open_mode::kLoadOrCreate,
+                  size_type chunk_bytes = kDefaultChunkBytes) noexcept;
+  ~disk_hash_index() = default;
+
+  open_code open(const path_type &path, open_mode mode = open_mode::kLoadOrCreate) noexcept;
+  bool attach(const char *image, size_type length) noexcept;
+  void close() { table_.close(); }
+  void sync() { table_.sync(); }
+  void sync(durability_mode mode) { table_.sync(mode); }
+
+  bool is_open() const noexcept { return table_.is_open(); }
+  operator bool() const noexcept { return is_open(); }
+  bool read_only() const noexcept { return table_.read_only(); }
+
+  size_type chunk_bytes() const noexcept { return table_.chunk_bytes(); }
+  void set_chunk_bytes(size_type chunk_bytes) noexcept { table_.set_chunk_bytes(chunk_bytes); }
+
+  double growth_factor() const noexcept { return table_.growth_factor(); }
+  void set_growth_factor(double growth_factor) noexcept { table_.set_growth_factor(growth_factor); }
+
+  durability_mode durability() const noexcept { return table_.durability(); }
+  void set_durability(durability_mode durability) noexcept { table_.set_durability(durability); }
+
+  access_advice advice() const noexcept { return table_.advice(); }
+  void set_advice(access_advice advice) noexcept { table_.set_advice(advice); }
+
+  bool populate() const noexcept { return table_.populate(); }
+  void set_populate(bool populate) noexcept { table_.set_populate(populate); }
+
+  bool resident() const noexcept { return table_.resident(); }
+  void set_resident(bool resident) noexcept { table_.set_resident(resident); }
+
+  size_type prefetch(size_type max_bytes) noexcept { return table_.prefetch(max_bytes); }
+  size_type resident_bytes() const noexcept { return table_.resident_bytes(); }
+  size_type size_bytes() const noexcept { return table_.size_bytes(); }
+
+  size_type size() const noexcept { return header().size; }
+  size_type bucket_count() const noexcept { return layout().bucket_count; }
+  bool empty() const noexcept { return size() == 0; }
+
+  template <class Pred>
+  std::optional<key_type> find(std::uint64_t hash, Pred &&pred) const;
+
+  void insert(std::uint64_t hash, const key_type &key);
+  void reserve(size_type count);
+  void clear();
+  // Moves the live table back to the front of the file, dropping the tables earlier rehashes left behind. No reader
+  // may probe the index meanwhile; an interrupted move leaves an index that fails to load and has to be rebuilt.
+  void shrink_to_fit();
+
+  void write_image(std::ostream &os) const;
+
+private:
+  struct header_t {
+    std::size_t magic;
+    std::size_t layout;
+    std::size_t size;
+    std::size_t reserved;
+  };
+
+  struct legacy_header_t {
+    std::size_t magic;
+    std::size_t bucket_count;
+    std::size_t size;
+    std::size_t rehashing;
+  };
+
+  struct layout_t {
+    size_type offset;
+    size_type bucket_count;
+  };
+
+  struct slot_t {
+    hash_type hash;
+    key_type key;
+  };
+
+  static constexpr std::size_t kMagic = 0x3258444948534148; // "HASHIDX2"
+  static constexpr std::size_t kLegacyMagic = 0x58444e4948534148; // "HASHINDX"
+  static constexpr size_type kMinBucketCount = 64;
+
+  disk_vector<std::byte> table_;
+
+  static size_type header_size() noexcept { return sizeof(header_t); }
+  static hash_type fold(std::uint64_t hash) noexcept;
+
+  header_t &header() noexcept { return *reinterpret_cast<header_t *>(table_.mutable_data(0, header_size())); }
+  const header_t &header() const noexcept { return *reinterpret_cast<const header_t *>(table_.data()); }
+
+  const slot_t *slots() const noexcept { return reinterpret_cast<const slot_t *>(table_.data() + header_size()); }
+  slot_t &slot(size_type index) noexcept {
+    return *reinterpret_cast<slot_t *>(table_.mutable_data(header_size() + index * sizeof(slot_t), sizeof(slot_t)));
+  }
+
+  // Rehashing appends the new table behind the old one and publishes it with a single store of the packed
+  // layout, so concurrent readers always probe a complete table.
+  static std::size_t pack(layout_t layout) noexcept;
+  static layout_t unpack(std::size_t packed) noexcept;
+  layout_t layout() const noexcept;
+  void publish(layout_t layout) noexcept;
+  bool upgrade_legacy() noexcept;
+  bool validate_layout() const noexcept;
+
+  void rehash(size_type bucket_count);
+  void place(size_type offset, size_type bucket_count, hash_type hash, const key_type &key) noexcept;
+};
+
+#include "details/disk_hash_index.ipp"
@@ -1,6 +1,9 @@
 #pragma once
+#include <atomic>
 #include <filesystem>
 #include <iterator>
+#include <memory>
+#include <ostream>
 #include <mio/mio.hpp>
 #include "config.hpp"
 
@@ -26,50 +29,83 @@ public:
   ~disk_vector() { close(); }
 
   open_code open(const path_type &path, open_mode mode = open_mode::kLoadOrCreate) noexcept;
+  bool attach(const char *image, size_type length) noexcept;
   void close();
-  void sync();
+  void sync() { sync(durability_); }
+  void sync(durability_mode mode);
 
-  bool is_open() const noexcept { return mmap_.is_open(); }
+  bool is_open() const noexcept { return mmap_.is_open() || source_.is_open() || view_; }
   operator bool() const noexcept { return is_open(); }
+  bool read_only() const noexcept { return read_only_; }
 
   size_type chunk_bytes() const noexcept { return chunk_bytes_; }
   void set_chunk_bytes(size_type chunk_bytes) noexcept { chunk_bytes_ = chunk_bytes; }
 
+  double growth_factor() const noexcept { return growth_factor_; }
+  void set_growth_factor(double growth_factor) noexcept { growth_factor_ = growth_factor; }
+
+  durability_mode durability() const noexcept { return durability_; }
+  void set_durability(durability_mode durability) noexcept { durability_ = durability; }
+
+  access_advice advice() const noexcept { return advice_; }
+  void set_advice(access_advice advice) noexcept;
+
+  bool populate() const noexcept { return populate_; }
+  void set_populate(bool populate) noexcept { populate_ = populate; }
+
+  bool resident() const noexcept { return resident_; }
+  void set_resident(bool resident) noexcept;
+
+  size_type prefetch(size_type max_bytes) noexcept;
+  size_type resident_bytes() const noexcept;
+
   static size_type element_size() noexcept { return sizeof(T); }
+  static size_type image_size(size_type count) noexcept { return header_size() + count * element_size(); }
+  static void write_image_header(std::ostream &os, size_type count);
+  static void write_image(std::ostream &os, const_pointer first, size_type count);
 
   size_type size() const noexcept { return header().size; }
   size_type length() const noexcept { return size(); }
-  size_type capacity() const noexcept { return (mmap_.size() - header_size()) / element_size(); }
+  bool empty() const noexcept { return size() == 0; }
+  size_type capacity() const noexcept { return (mapped_length() - header_size()) / element_size(); }
+  size_type size_bytes() const noexcept { return is_open() ? header_size() + size() * element_size() : 0; }
 
-  iterator begin() noexcept { return data(); }
+  iterator begin() { return data(); }
   const_iterator begin() const noexcept { return data(); }
   const_iterator cbegin() const noexcept { return data(); }
 
-  iterator end() noexcept { return data() + size(); }
+  iterator end() { return data() + size(); }
   const_iterator end() const noexcept { return data() + size(); }
   const_iterator cend() const noexcept { return data() + size(); }
 
-  reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+  reverse_iterator rbegin() { return reverse_iterator(end()); }
   const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator(end()); }
   const_reverse_iterator crbegin() const noexcept { return const_reverse_iterator(end()); }
 
-  reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+  reverse_iterator rend() { return reverse_iterator(begin()); }
   const_reverse_iterator rend() const noexcept { return const_reverse_iterator(begin()); }
   const_reverse_iterator crend() const noexcept { return const_reverse_iterator(begin()); }
 
-  pointer data() noexcept { return reinterpret_cast<pointer>(mmap_.data() + header_size()); }
-  const_pointer data() const noexcept { return reinterpret_cast<const_pointer>(mmap_.data() + header_size()); }
+  pointer data() { return mutable_data(0, size()); }
+  const_pointer data() const noexcept { return reinterpret_cast<const_pointer>(memory_data() + header_size()); }
 
-  reference operator[](size_type index) noexcept { return data()[index]; }
+  // Writable elements [index, index + count), which may run past size() up to capacity(). Scattered writers should
+  // prefer it to data(), which marks the whole vector for write-back while a resident copy is loaded.
+  pointer mutable_data(size_type index, size_type count) {
+    auto offset = header_size() + index * element_size();
+    return reinterpret_cast<pointer>(writable_data(offset, count * element_size()) + offset);
+  }
+
+  reference operator[](size_type index) { return *mutable_data(index, 1); }
   const_reference operator[](size_type index) const noexcept { return data()[index]; }
 
-  reference at(size_type index) noexcept { return data()[index]; }
+  reference at(size_type index) { return *mutable_data(index, 1); }
   const_reference at(size_type index) const noexcept { return data()[index]; }
 
-  reference front() noexcept { return data()[0]; }
+  reference front() { return *mutable_data(0, 1); }
   const_reference front() const noexcept { return data()[0]; }
 
-  reference back() noexcept { return data()[size() - 1]; }
+  reference back() { return *mutable_data(size() - 1, 1); }
   const_reference back() const noexcept { return data()[size() - 1]; }
 
   void reserve(size_type capacity);
@@ -90,8 +126,21 @@ public:
 
 private:
   mio::mmap_sink mmap_;
+  mio::mmap_source source_;
+  bool read_only_ = false;
+  const char *view_ = nullptr;
+  size_type view_length_ = 0;
   path_type path_;
   size_type chunk_bytes_;
+  double growth_factor_ = kDefaultGrowthFactor;
+  durability_mode durability_ = kSyncFull;
+  access_advice advice_ = kAdviceNormal;
+  bool populate_ = false;
+  bool resident_ = false;
+  char *memory_ = nullptr;
+  size_type memory_length_ = 0;
+  std::unique_ptr<std::uint64_t[]> dirty_;
+  std::atomic<const char *> base_ = nullptr;
 
   struct header_t {
     size_type magic;
@@ -103,12 +152,33 @@ private:
 
   static size_type header_size() noexcept { return sizeof(header_t); }
 
-  header_t &header() noexcept { return *reinterpret_cast<header_t *>(mmap_.data()); }
-  const header_t &header() const noexcept { return *reinterpret_cast<const header_t *>(mmap_.data()); }
+  static constexpr size_type kHugePageBytes = 2 * MiB;
+  static constexpr size_type kDirtyBlockBytes = 4 * KiB;
+
+  const char *mapping() const noexcept { return view_ ? view_ : read_only_ ? source_.data() : mmap_.data(); }
+  size_type mapped_length() const noexcept {
+    return view_ ? view_length_ : read_only_ ? source_.mapped_length() : mmap_.mapped_length();
+  }
+
+  // While a resident copy is loaded it takes every write, and sync copies the touched blocks back to the file.
+  // Read-only mappings refuse writable access like reserve and resize do.
+  char *writable_data(size_type offset, size_type length);
+  const char *memory_data() const noexcept { return base_.load(std::memory_order_acquire); }
+  void publish() noexcept { base_.store(memory_ ? memory_ : mapping(), std::memory_order_release); }
+
+  header_t &header() { return *reinterpret_cast<header_t *>(writable_data(0, header_size())); }
+  const header_t &header() const noexcept { return *reinterpret_cast<const header_t *>(memory_data()); }
+
+  void load_memory() noexcept;
+  void flush_memory() noexcept;
+  void release_memory() noexcept;
+  static void retire_memory(char *memory, size_type length) noexcept;
 
   bool validate_header() const noexcept { return header().magic == kMagic && header().element_size == element_size(); }
 
-  bool load(const path_type &path) noexcept;
+  void map(std::error_code &error);
+
+  bool load(const path_type &path, bool read_only) noexcept;
   bool create(const path_type &path) noexcept;
 };
 
@@ -0,0 +1,138 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class epoch_domain;
+
+class epoch_guard {
+public:
+  epoch_guard() noexcept = default;
+  epoch_guard(epoch_guard &&other) noexcept
+    : domain_(std::exchange(other.domain_, nullptr)), slot_(std::exchange(other.slot_, nullptr)) {}
+  epoch_guard &operator=(epoch_guard &&other) noexcept {
+    if (this != &other) {
+      release();
+      domain_ = std::exchange(other.domain_, nullptr);
+      slot_ = std::exchange(other.slot_, nullptr);
+    }
+    return *this;
+  }
+  ~epoch_guard() { release(); }
+
+  bool active() const noexcept { return slot_ != nullptr; }
+  void release() noexcept;
+
+private:
+  friend class epoch_domain;
+  epoch_guard(epoch_domain *domain, std::atomic<std::uint64_t> *slot) noexcept : domain_(domain), slot_(slot) {}
+
+  epoch_domain *domain_ = nullptr;
+  std::atomic<std::uint64_t> *slot_ = nullptr;
+};
+
+// Readers pin the current epoch into a slot; memory retired at epoch e is freed once no slot holds an epoch <= e.
+// Readers beyond kMaxReaders share an overflow slot, which stays at the oldest epoch pinned into it until all of them
+// have released it, so they only hold back reclamation for longer.
+class epoch_domain {
+public:
+  static constexpr std::size_t kMaxReaders = 256;
+
+  epoch_domain() noexcept = default;
+  epoch_domain(const epoch_domain &) = delete;
+  epoch_domain &operator=(const epoch_domain &) = delete;
+  ~epoch_domain() {
+    for (auto &[epoch, reclaim] : retired_) reclaim();
+  }
+
+  static epoch_domain &global() noexcept {
+    static epoch_domain domain;
+    return domain;
+  }
+
+  epoch_guard pin() noexcept {
+    auto epoch = epoch_.load(std::memory_order_seq_cst);
+    for (auto &slot : slots_) {
+      std::uint64_t idle = 0;
+      if (slot.epoch.compare_exchange_strong(idle, epoch, std::memory_order_seq_cst))
+        return epoch_guard(this, &slot.epoch);
+    }
+    std::lock_guard lock(overflow_mutex_);
+    if (overflow_readers_++ == 0)
+      overflow_.epoch.store(epoch_.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    return epoch_guard(this, &overflow_.epoch);
+  }
+
+  void retire(std::function<void()> reclaim) {
+    auto epoch = epoch_.fetch_add(1, std::memory_order_seq_cst);
+    std::lock_guard lock(retired_mutex_);
+    retired_.emplace_back(epoch, std::move(reclaim));
+    collect_locked();
+  }
+
+  void collect() {
+    std::lock_guard lock(retired_mutex_);
+    collect_locked();
+  }
+
+  void synchronize() {
+    auto epoch = epoch_.fetch_add(1, std::memory_order_seq_cst);
+    while (oldest_pinned() <= epoch) std::this_thread::yield();
+    collect();
+  }
+
+private:
+  struct alignas(64) slot_t {
+    std::atomic<std::uint64_t> epoch{0};
+  };
+
+  std::atomic<std::uint64_t> epoch_{1};
+  std::array<slot_t, kMaxReaders> slots_;
+  slot_t overflow_;
+  std::mutex overflow_mutex_;
+  std::size_t overflow_readers_ = 0;
+  std::mutex retired_mutex_;
+  std::vector<std::pair<std::uint64_t, std::function<void()>>> retired_;
+
+  friend class epoch_guard;
+
+  void unpin(std::atomic<std::uint64_t> *slot) noexcept {
+    if (slot != &overflow_.epoch) {
+      slot->store(0, std::memory_order_release);
+      return;
+    }
+    std::lock_guard lock(overflow_mutex_);
+    if (--overflow_readers_ == 0) overflow_.epoch.store(0, std::memory_order_release);
+  }
+
+  std::uint64_t oldest_pinned() const noexcept {
+    auto oldest = UINT64_MAX;
+    for (const auto &slot : slots_)
+      if (auto epoch = slot.epoch.load(std::memory_order_seq_cst); epoch != 0 && epoch < oldest) oldest = epoch;
+    if (auto epoch = overflow_.epoch.load(std::memory_order_seq_cst); epoch != 0 && epoch < oldest) oldest = epoch;
+    return oldest;
+  }
+
+  void collect_locked() {
+    auto oldest = oldest_pinned();
+    auto it = std::partition(retired_.begin(), retired_.end(), [oldest](const auto &entry) {
+      return entry.first >= oldest;
+    });
+    std::vector<std::function<void()>> reclaimable;
+    for (auto reclaim = it; reclaim != retired_.end(); ++reclaim) reclaimable.emplace_back(std::move(reclaim->second));
+    retired_.erase(it, retired_.end());
+    for (auto &reclaim : reclaimable) reclaim();
+  }
+};
+
+inline void epoch_guard::release() noexcept {
+  if (slot_) domain_->unpin(slot_);
+  domain_ = nullptr;
+  slot_ = nullptr;
+}
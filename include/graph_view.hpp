@@ -1,5 +1,7 @@
 #pragma once
 #include <functional>
+#include <memory>
+#include <string>
 #include <string_view>
 #include <vector>
 #include "config.hpp"
@@ -12,6 +14,8 @@ struct PackageView {
   PackageId id;
   std::string_view name;
   std::function<std::vector<VersionView>()> versions;
+  // Holds the viewed string when it was decoded from a compressed string pool.
+  std::shared_ptr<const std::string> storage;
 };
 
 struct VersionView {
@@ -19,6 +23,7 @@ struct VersionView {
   std::string_view version;
   std::string_view architecture;
   std::function<std::vector<DependencyView>()> dependencies;
+  std::shared_ptr<const std::string> storage;
 };
 
 struct DependencyView {
@@ -29,4 +34,5 @@ struct DependencyView {
   std::string_view version_constraint;
   std::string_view architecture_constraint;
   GroupId group;
+  std::shared_ptr<const std::string> storage;
 };
@@ -1,31 +1,145 @@
 #pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
+#include <mio/mio.hpp>
 #include "dependency_graph.hpp"
 
 class PackageLoader {
 public:
-  PackageLoader(DependencyGraph &graph) : graph_(graph) {}
+  PackageLoader(DependencyGraph &graph)
+    : graph_(graph), parse_threads_(std::max(std::thread::hardware_concurrency(), 1u)) {}
   ~PackageLoader() = default;
 
+  // Input is split at stanza boundaries and parsed by up to this many threads; stanzas still reach the buffer in file
+  // order, so ids do not depend on the thread count. A dataset is loaded as a pipeline: one thread maps and hashes
+  // upcoming files, these threads parse them and the calling thread applies them to the graph.
+  std::size_t parse_threads() const noexcept { return parse_threads_; }
+  void set_parse_threads(std::size_t parse_threads) noexcept { parse_threads_ = parse_threads; }
+
   void load_package(std::string_view raw_package) const noexcept;
   void load_packages(std::string_view raw_packages) const noexcept;
 
+  // Files and stanzas whose content hashes match what the graph already holds are skipped without parsing.
   bool load_packages_file(const std::filesystem::path &path, bool verbose = false) const noexcept;
   bool load_dataset_file(const std::filesystem::path &path, bool verbose = false) const noexcept;
 
+  // Replaces the repository named by the file's path with the file's contents; versions it dropped are tombstoned.
+  bool refresh_packages_file(const std::filesystem::path &path, bool verbose = false) const noexcept;
+  bool refresh_dataset_file(const std::filesystem::path &path, bool verbose = false) const noexcept;
+
 private:
+  constexpr static std::size_t kMinParseChunkBytes = 256 * KiB;
+
   DependencyGraph &graph_;
+  std::size_t parse_threads_;
 
+  // Parsed without touching the graph's symbol tables: an architecture not yet known is interned when the stanza is
+  // loaded, in file order.
   struct DependencyItem {
     std::string_view package_name;
     std::string_view version_constraint;
-    ArchitectureType architecture_constraint;
+    std::string_view architecture_name;
+    std::optional<ArchitectureType> architecture_constraint;
+    DependencyType dependency_type;
     GroupId group;
   };
 
-  DependencyItem parse_dependency(std::string_view raw_dep, GroupId group) const noexcept;
-  std::vector<DependencyItem> parse_dependencies(std::string_view raw_deps, GroupId &group) const noexcept;
+  struct StagedStanza {
+    std::uint64_t content_hash;
+    // Set when the stanza was already on disk at parse time; its dependencies are then left unparsed.
+    std::optional<VersionId> version_id;
+    std::optional<std::string_view> package_name;
+    std::optional<std::string_view> version;
+    std::optional<std::string_view> architecture;
+    std::size_t dependency_end;
+  };
+
+  // A chunk's stanzas in file order; each one's dependencies end at its dependency_end.
+  struct StagedChunk {
+    std::vector<StagedStanza> stanzas;
+    std::vector<DependencyItem> dependencies;
+  };
+
+  DependencyItem parse_dependency(std::string_view raw_dep, DependencyType dtype, GroupId group,
+                                  bool lookup) const noexcept;
+  void parse_dependencies(std::string_view raw_deps, DependencyType dtype, GroupId &group, bool lookup,
+                          std::vector<DependencyItem> &items) const noexcept;
+
+  // Unchanged files match their recorded size and mtime; rewritten ones only their content, so the record is renewed.
+  enum source_state { kSourceFailed, kSourceUnchanged, kSourceRewritten, kSourceChanged };
+
+  struct LoadStats {
+    std::size_t package_count = 0;
+    std::size_t version_count = 0;
+    std::size_t dependency_count = 0;
+    std::size_t flush_count = 0;
+
+    LoadStats &operator+=(const LoadStats &other) noexcept {
+      package_count += other.package_count;
+      version_count += other.version_count;
+      dependency_count += other.dependency_count;
+      flush_count += other.flush_count;
+      return *this;
+    }
+  };
+
+  // Slots of the fields a stanza is loaded from, followed by one per dependency type.
+  enum field_slot : std::size_t { kPackageField, kVersionField, kArchitectureField, kDependencyFields };
+
+  struct StageTimes {
+    std::chrono::milliseconds read{};
+    std::chrono::milliseconds parse{};
+    std::chrono::milliseconds apply{};
+    // Time the apply stage spent waiting for input to be read and parsed.
+    std::chrono::milliseconds apply_wait{};
+  };
 
+  std::vector<std::string_view> field_names() const;
+  // Safe to run on several threads at once. With lookup, stanzas already on disk and known architectures are resolved
+  // against the graph, which nothing may modify meanwhile; without it the graph is not touched.
+  void stage_stanza(std::string_view stanza, std::span<const std::optional<std::string_view>> values, bool lookup,
+                    StagedChunk &chunk) const noexcept;
+  StagedChunk stage_packages(std::string_view raw_packages, std::span<const std::string_view> fields,
+                             bool lookup) const noexcept;
+  std::optional<VersionId> find_stanza(const StagedStanza &stanza) const;
+  void load_stanza(const StagedStanza &stanza, std::span<const DependencyItem> dependencies,
+                   std::vector<VersionId> *version_ids) const noexcept;
+  LoadStats load_staged(const StagedChunk &chunk, std::vector<VersionId> *version_ids) const noexcept;
+  // With version_ids the buffer is building a repository: skipped stanzas and versions flushed once the buffer hits
+  // the memory limit append their disk ids.
+  void load_package(std::string_view raw_package, std::vector<VersionId> *version_ids) const noexcept;
+  LoadStats load_packages(std::string_view raw_packages, std::vector<VersionId> *version_ids) const noexcept;
+  // The prefix of text ending just past the first stanza separator at or after min_bytes, or all of text.
+  static std::string_view stanza_prefix(std::string_view text, std::size_t min_bytes) noexcept;
+  static std::string_view input_view(const mio::mmap_source &input) noexcept;
+  static void release_input(std::string_view region) noexcept;
+  // Parses a mapped file region by region and drops each region's pages once its stanzas are in the buffer.
+  LoadStats load_input(const mio::mmap_source &input, std::vector<VersionId> *version_ids) const noexcept;
+  // Compares a file with its recorded source, mapping it only when its size or mtime differ. It is then hashed up
+  // front only if it may be a rewrite of the recorded contents or hash_changed asks for it. Does not touch the graph,
+  // so it may run on a thread of its own.
+  source_state read_source(const std::filesystem::path &path, const std::optional<SourceFile> &recorded,
+                           bool hash_changed, SourceFile &source, mio::mmap_source &input) const noexcept;
+  // A recorded file still describes the graph while its versions are live: a repository keeps its own, and a plain
+  // load needs no tombstones since.
+  bool source_current(const std::filesystem::path &path, bool repository,
+                      const std::optional<SourceFile> &recorded) const noexcept;
+  source_state read_packages_file(const std::filesystem::path &path, bool verbose, bool repository,
+                                  SourceFile &source, mio::mmap_source &input) const noexcept;
+  // Loads a changed file through load, as a plain load or as a refresh of its repository, and records its source.
+  void load_source(const std::filesystem::path &path, const SourceFile &source, bool verbose,
+                   const std::function<LoadStats(std::vector<VersionId> *)> &load) const;
+  bool load_source_file(const std::filesystem::path &path, bool verbose, bool repository) const noexcept;
+  std::size_t load_source_files(const std::vector<std::string> &paths, bool verbose, bool repository,
+                                StageTimes &times) const noexcept;
+  bool load_dataset(const std::filesystem::path &path, bool verbose, bool refresh) const noexcept;
 };
@@ -1,6 +1,11 @@
 #pragma once
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <string>
 #include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <nlohmann/json.hpp>
 #include "graph_view.hpp"
@@ -19,7 +24,17 @@ struct DependencyLevel {
   std::vector<DependencyGroup> or_dependencies;
 };
 
-using DependencyResult = std::vector<DependencyLevel>;
+// Items view strings owned by the graph, except those decoded from a compressed string pool, which the result keeps
+// by handle, and those read from a buffer, which it copies; both are shared between its copies. A result queried
+// without a snapshot pins one of its own until its last copy is destroyed, so the strings stay mapped while writers
+// flush, and compaction waits for it meanwhile.
+struct DependencyResult : std::vector<DependencyLevel> {
+  using std::vector<DependencyLevel>::vector;
+
+  std::shared_ptr<std::unordered_map<std::uint64_t, std::string>> strings;
+  std::shared_ptr<std::unordered_set<std::string>> buffered_strings;
+  std::shared_ptr<const void> snapshot;
+};
 
 inline bool operator==(const DependencyItem &l, const DependencyItem &r) noexcept {
   return l.package_name == r.package_name && l.dependency_type == r.dependency_type
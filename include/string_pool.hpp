@@ -1,9 +1,15 @@
 #pragma once
+#include <array>
 #include <iterator>
+#include <memory>
+#include <shared_mutex>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include "config.hpp"
 #include "disk_vector.hpp"
+#include "epoch.hpp"
+#include "symbol_codec.hpp"
 
 struct string_handle {
   using offset_type = string_handle_offset_t;
@@ -64,27 +70,64 @@ public:
   basic_string_pool_base(size_type chunk_bytes = kDefaultChunkBytes) noexcept : pool_(chunk_bytes) {}
   basic_string_pool_base(const path_type &path, open_mode mode = open_mode::kLoadOrCreate,
                          size_type chunk_bytes = kDefaultChunkBytes) noexcept;
-  ~basic_string_pool_base() = default;
+  ~basic_string_pool_base() { retire_cache(); }
 
   open_code open(const path_type &path, open_mode mode = open_mode::kLoadOrCreate) noexcept;
-  void close() { pool_.close(); }
+  bool attach(const char *image, size_type length) noexcept;
+  void close();
   void sync() { pool_.sync(); }
+  void sync(durability_mode mode) { pool_.sync(mode); }
 
   bool is_open() const noexcept { return pool_.is_open(); }
   operator bool() const noexcept { return is_open(); }
+  bool read_only() const noexcept { return pool_.read_only(); }
 
   size_type chunk_bytes() const noexcept { return pool_.chunk_bytes(); }
   void set_chunk_bytes(size_type chunk_bytes) noexcept { pool_.set_chunk_bytes(chunk_bytes); }
 
+  double growth_factor() const noexcept { return pool_.growth_factor(); }
+  void set_growth_factor(double growth_factor) noexcept { pool_.set_growth_factor(growth_factor); }
+
+  durability_mode durability() const noexcept { return pool_.durability(); }
+  void set_durability(durability_mode durability) noexcept { pool_.set_durability(durability); }
+
+  access_advice advice() const noexcept { return pool_.advice(); }
+  void set_advice(access_advice advice) noexcept { pool_.set_advice(advice); }
+
+  bool populate() const noexcept { return pool_.populate(); }
+  void set_populate(bool populate) noexcept { pool_.set_populate(populate); }
+
+  bool resident() const noexcept { return pool_.resident(); }
+  void set_resident(bool resident) noexcept { pool_.set_resident(resident); }
+
+  size_type prefetch(size_type max_bytes) noexcept { return pool_.prefetch(max_bytes); }
+  size_type resident_bytes() const noexcept { return pool_.resident_bytes(); }
+  size_type size_bytes() const noexcept { return pool_.size_bytes(); }
+
   size_type size() const noexcept { return pool_.size(); }
   size_type capacity() const noexcept { return pool_.capacity(); }
+  const char_type *data() const noexcept { return pool_.data(); }
+
+  void write_image(std::ostream &os, size_type size) const { pool_.write_image(os, pool_.data(), size); }
 
   void reserve(size_type capacity) { pool_.reserve(capacity); }
-  void resize(size_type size) { pool_.resize(size); }
-  void clear() { pool_.clear(); }
+  void resize(size_type size);
+  void clear();
+
+  // A compressed pool starts with its symbol table and stores every string as codes; handles keep the decoded
+  // length. Only an empty pool can switch modes.
+  bool compressed() const noexcept { return codec_ != nullptr; }
+  void set_compressed(bool compressed);
 
+  // On a compressed pool the view points into a bounded decode cache and stays valid while the caller holds an
+  // epoch pin; codes that run past the pool, or a cache that cannot grow, give an empty view. The buffer overload
+  // decodes into caller storage instead.
   view_type get(handle_type::offset_type offset, handle_type::length_type length) const noexcept;
   view_type get(handle_type handle) const noexcept { return get(handle.offset, handle.length); }
+  view_type get(handle_type handle, std::basic_string<char_type, traits_type> &buffer) const;
+
+  bool equal(handle_type::offset_type offset, handle_type::length_type length, view_type view) const noexcept;
+  bool equal(handle_type handle, view_type view) const noexcept { return equal(handle.offset, handle.length, view); }
 
   handle_type add(view_type view);
   handle_type append(view_type view) { return add(view); }
@@ -92,7 +135,30 @@ public:
   basic_string_pool_base &operator+=(view_type view);
 
 protected:
+  static constexpr bool kCompressible = std::is_same_v<char_type, char> && !NullTerminated
+    && std::is_same_v<traits_type, std::char_traits<char>>;
+
   disk_vector<char_type> pool_;
+  std::unique_ptr<symbol_codec> codec_;
+
+  // Decoded strings are copied into a fixed arena and indexed direct-mapped by offset and length: an empty string
+  // shares its offset with the string added after it. A full arena is retired whole through the epoch domain.
+  static constexpr std::size_t kCacheLengthBits = 8 * sizeof(handle_type::length_type);
+  static constexpr std::size_t kCacheSlotBits = 14;
+  static constexpr std::size_t kCacheBytes = 1 * MiB;
+  struct cache_arena {
+    std::array<std::uint64_t, std::size_t(1) << kCacheSlotBits> keys;
+    std::array<const char_type *, std::size_t(1) << kCacheSlotBits> strings{};
+    std::size_t used = 0;
+    char_type bytes[kCacheBytes];
+  };
+  mutable std::shared_mutex cache_mutex_;
+  mutable cache_arena *cache_ = nullptr;
+
+  void load_codec() noexcept;
+  const char_type *codes_end(handle_type::offset_type offset, handle_type::length_type length) const noexcept;
+  view_type decoded(handle_type::offset_type offset, handle_type::length_type length) const noexcept;
+  void retire_cache() const;
 };
 
 template <class Char, bool NullTerminated = false, class Traits = std::char_traits<Char>>
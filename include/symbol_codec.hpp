@@ -0,0 +1,157 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// Static symbol table compression in the spirit of FSST: up to 255 symbols of one to eight bytes are each replaced by
+// a one-byte code, and kEscape precedes a literal byte. Every string is encoded on its own, so it decodes from the
+// position of its first code given its decoded length.
+class symbol_codec {
+public:
+  using size_type = std::size_t;
+
+  static constexpr size_type kMaxSymbols = 255;
+  static constexpr size_type kMaxSymbolLength = 8;
+  static constexpr std::uint8_t kEscape = 255;
+  static constexpr std::uint64_t kMagic = 0x4345444f434d5953; // "SYMCODEC"
+
+  struct table_t {
+    std::uint64_t magic;
+    std::uint8_t lengths[kMaxSymbols];
+    char symbols[kMaxSymbols][kMaxSymbolLength];
+  };
+
+  symbol_codec() noexcept : symbol_codec(default_table()) {}
+  explicit symbol_codec(const table_t &table) noexcept;
+
+  static const table_t &default_table() noexcept;
+  static bool valid(const table_t &table) noexcept;
+  const table_t &table() const noexcept { return table_; }
+
+  static constexpr size_type max_encoded_length(size_type length) noexcept { return 2 * length; }
+
+  // out must hold max_encoded_length(str.size()) bytes; returns the number of bytes written.
+  size_type encode(std::string_view str, char *out) const noexcept;
+  // out must hold length + kMaxSymbolLength bytes; returns the end of the consumed codes, or nullptr if the codes in
+  // [in, end) do not decode to exactly length bytes.
+  const char *decode(const char *in, const char *end, char *out, size_type length) const noexcept;
+  bool equal(const char *in, const char *end, std::string_view str) const noexcept;
+
+private:
+  table_t table_;
+  std::array<std::uint8_t, kMaxSymbols> order_{};
+  std::array<std::uint16_t, 257> first_{};
+};
+
+inline symbol_codec::symbol_codec(const table_t &table) noexcept : table_(table) {
+  // Codes grouped by first byte, longest first, so encode() takes the first match as the longest.
+  std::array<std::uint16_t, 256> counts{};
+  for (size_type code = 0; code < kMaxSymbols; ++code)
+    if (table_.lengths[code]) ++counts[static_cast<std::uint8_t>(table_.symbols[code][0])];
+  for (size_type c = 0; c < 256; ++c) first_[c + 1] = first_[c] + counts[c];
+  auto next = first_;
+  for (size_type code = 0; code < kMaxSymbols; ++code)
+    if (table_.lengths[code]) order_[next[static_cast<std::uint8_t>(table_.symbols[code][0])]++] = code;
+  for (size_type c = 0; c < 256; ++c)
+    std::stable_sort(order_.begin() + first_[c], order_.begin() + first_[c + 1], [this](auto l, auto r) {
+      return table_.lengths[l] > table_.lengths[r];
+    });
+}
+
+inline auto symbol_codec::default_table() noexcept -> const table_t & {
+  // Frequent fragments of Debian package names, versions and version constraints, then every character that
+  // commonly occurs alone so that few bytes need an escape.
+  static constexpr std::string_view kSymbols[] = {
+    "lib", "python3-", "python-", "perl", "linux-", "gir1.2-", "fonts-", "libghc-", "libjs-", "python", "rust-",
+    "libgst", "libx", "libxcb-", "libgl", "glib", "libglib", "libboost", "libstd", "libc6", "libc", "libg", "libs",
+    "libp", "libm", "liba", "libd", "libe", "libf", "libh", "libi", "libl", "libn", "libo", "libr", "libt", "libu",
+    "libv", "libw", "-dev", "-doc", "-common", "-data", "-dbg", "-utils", "-tools", "-bin", "-core", "-base",
+    "-extra", "-plugin", "-perl", "-java", "-locale", "-static", "-runtime", "-server", "-client", "-module",
+    "-tests", "-mod", "-lib", "~deb12u", "+deb", "deb", "+dfsg", "dfsg", "+ds", "+b1", "+b2", "+b", "+git", "git20",
+    "ubuntu", "build", "~rc", "~beta", "+repack", "+nmu", "1:", "2:", "-1", "-2", "-3", "-4", "-5", ".0", ".1", ".2",
+    ".3", ".4", ".5", ".6", ".7", ".8", ".9", "0.", "1.", "2.", "3.", "4.", "5.", "6.", "7.", "8.", "9.", "0-", "1-",
+    "2-", "10", "11", "12", "13", "14", "15", "16", "18", "19", "20", "201", "2020", "2021", "2022", "2023", "00",
+    "0.0", "1.0", "2.0", "0.1", "1.1", "1.2", "3.0", "ing", "tion", "er", "re", "in", "on", "an", "en", "es", "st",
+    "ar", "or", "te", "al", "ng", "le", "de", "co", "ti", "ra", "ma", "ca", "pe", "pl", "se", "ne", "ro", "li", "it",
+    "at", "ed", "ic", "ge", "is", "nt", "ve", "me", "ss", "util", "tool", "common", "font", "xml", "ssl", "http",
+    "test", "gnu", "net", "sys", "crypt", "compat", "config", "conf", "tcl", "node", "postgres", "db", "image",
+    "media", "client", "core", "x86", "64", "32", "dev", "doc", "data", ">= ", "<= ", "<< ", ">> ", "= ", ">= 0",
+    ">= 1", ">= 2", ">= 3", "<< 1", "<< 2", "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o",
+    "p", "q", "r", "s", "t", "u", "v", "w", "x", "y", "z", "0", "1", "2", "3", "4", "5", "6", "7", "8", "9", ".", "-",
+    "+", "~", ":", " ", "<", ">", "=",
+  };
+  static_assert(std::size(kSymbols) <= kMaxSymbols);
+  static const table_t table = [] {
+    table_t table{};
+    table.magic = kMagic;
+    for (size_type code = 0; code < std::size(kSymbols); ++code) {
+      table.lengths[code] = static_cast<std::uint8_t>(kSymbols[code].size());
+      std::memcpy(table.symbols[code], kSymbols[code].data(), kSymbols[code].size());
+    }
+    return table;
+  }();
+  return table;
+}
+
+inline bool symbol_codec::valid(const table_t &table) noexcept {
+  if (table.magic != kMagic) return false;
+  return std::all_of(std::begin(table.lengths), std::end(table.lengths), [](auto length) {
+    return length <= kMaxSymbolLength;
+  });
+}
+
+inline auto symbol_codec::encode(std::string_view str, char *out) const noexcept -> size_type {
+  auto *begin = out;
+  for (size_type i = 0; i < str.size();) {
+    auto c = static_cast<std::uint8_t>(str[i]);
+    auto match = std::find_if(order_.begin() + first_[c], order_.begin() + first_[c + 1], [&](auto code) {
+      return table_.lengths[code] <= str.size() - i
+        && std::memcmp(table_.symbols[code], str.data() + i, table_.lengths[code]) == 0;
+    });
+    if (match != order_.begin() + first_[c + 1]) {
+      *out++ = static_cast<char>(*match);
+      i += table_.lengths[*match];
+    } else {
+      *out++ = static_cast<char>(kEscape);
+      *out++ = str[i++];
+    }
+  }
+  return out - begin;
+}
+
+inline const char *symbol_codec::decode(const char *in, const char *end, char *out, size_type length) const noexcept {
+  auto *last = out + length;
+  while (out < last) {
+    if (in == end) return nullptr;
+    auto code = static_cast<std::uint8_t>(*in++);
+    if (code == kEscape) {
+      if (in == end) return nullptr;
+      *out++ = *in++;
+      continue;
+    }
+    if (table_.lengths[code] == 0) return nullptr;
+    // Symbols are padded to kMaxSymbolLength, so a fixed-size copy is cheaper than one of the exact length.
+    std::memcpy(out, table_.symbols[code], kMaxSymbolLength);
+    out += table_.lengths[code];
+  }
+  return out == last ? in : nullptr;
+}
+
+inline bool symbol_codec::equal(const char *in, const char *end, std::string_view str) const noexcept {
+  for (size_type i = 0; i < str.size();) {
+    if (in == end) return false;
+    auto code = static_cast<std::uint8_t>(*in++);
+    if (code == kEscape) {
+      if (in == end || *in++ != str[i++]) return false;
+      continue;
+    }
+    auto length = table_.lengths[code];
+    if (length == 0 || length > str.size() - i || std::memcmp(table_.symbols[code], str.data() + i, length) != 0)
+      return false;
+    i += length;
+  }
+  return true;
+}
@@ -65,17 +65,25 @@ public:
 
   open_code open(const path_type &path, open_mode mode = open_mode::kLoadOrCreate,
                  std::initializer_list<view_type> symbols = {}) noexcept;
+  bool attach(const char *image, size_type length) noexcept;
   void close();
   void sync() { symbols_.sync(); }
+  void sync(durability_mode mode) { symbols_.sync(mode); }
 
   bool is_open() const noexcept { return symbols_.is_open(); }
   operator bool() const noexcept { return is_open(); }
+  bool read_only() const noexcept { return symbols_.read_only(); }
 
   size_type chunk_bytes() const noexcept { return symbols_.chunk_bytes(); }
   void set_chunk_bytes(size_type chunk_bytes) noexcept { symbols_.set_chunk_bytes(chunk_bytes); }
 
+  durability_mode durability() const noexcept { return symbols_.durability(); }
+  void set_durability(durability_mode durability) noexcept { symbols_.set_durability(durability); }
+
   size_type size() const noexcept { return id_to_symbol_.size(); }
   size_type symbol_count() const noexcept { return size(); }
+  size_type symbol_bytes(size_type count) const noexcept;
+  const char_type *data() const noexcept { return symbols_.data(); }
 
   iterator begin() noexcept { return iterator(id_to_symbol_.begin(), symbols_); }
   const_iterator begin() const noexcept { return const_iterator(id_to_symbol_.begin(), symbols_); }
@@ -105,10 +113,16 @@ public:
   id_type add(view_type symbol);
   id_type append(view_type symbol) { return add(symbol); }
 
+  void truncate(size_type count);
+  void write_image(std::ostream &os, size_type count) const;
+
 private:
   basic_string_pool<char_type, true, traits_type> symbols_;
   std::vector<string_handle> id_to_symbol_;
   basic_string_handle_map<id_type, char_type, true, traits_type> symbol_to_id_;
+
+  void reserve_ids();
+  void load_symbols();
 };
 
 template <class Id>
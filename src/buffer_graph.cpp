@@ -1,80 +1,149 @@
 #include "buffer_graph.hpp"
-#include <ranges>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+BufferGraph::BufferGraph(std::size_t chunk_bytes) noexcept
+  : strings_(chunk_bytes, &memory_), package_nodes_(&memory_), version_nodes_(&memory_), dependency_edges_(&memory_),
+    package_slots_(&memory_), version_slots_(&memory_) {}
+
+std::string_view BufferGraph::store(std::string_view str) {
+  if (str.empty()) return "";
+  auto *data = static_cast<char *>(strings_.allocate(str.size(), alignof(char)));
+  std::memcpy(data, str.data(), str.size());
+  return {data, str.size()};
+}
+
+std::size_t BufferGraph::package_hash(std::string_view name) noexcept { return std::hash<std::string_view>{}(name); }
+
+std::size_t BufferGraph::version_hash(PackageId pid, std::string_view version, ArchitectureType arch) noexcept {
+  auto seed = std::hash<std::string_view>{}(version);
+  seed ^= pid + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+  return seed ^ (arch + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
+
+std::size_t BufferGraph::version_hash(VersionId vid) const noexcept {
+  const auto &vnode = version_nodes_[vid];
+  return version_hash(vnode.package_id, vnode.version, vnode.architecture);
+}
+
+template <class Id, class Equal>
+std::optional<Id> BufferGraph::find_slot(const std::pmr::vector<Id> &slots, std::size_t hash, Equal &&equal) noexcept {
+  if (slots.empty()) return std::nullopt;
+  auto mask = slots.size() - 1;
+  for (auto i = hash & mask;; i = (i + 1) & mask) {
+    if (slots[i] == 0) return std::nullopt;
+    if (equal(slots[i] - 1)) return slots[i] - 1;
+  }
+}
+
+template <class Id, class Hash>
+void BufferGraph::insert_slot(std::pmr::vector<Id> &slots, std::size_t count, Id id, std::size_t hash,
+                              Hash &&rehash) {
+  auto place = [](std::pmr::vector<Id> &table, Id id, std::size_t hash) {
+    auto mask = table.size() - 1;
+    auto i = hash & mask;
+    while (table[i] != 0) i = (i + 1) & mask;
+    table[i] = id + 1;
+  };
+  if ((count + 1) * 4 > slots.size() * 3) {
+    std::pmr::vector<Id> grown(std::bit_ceil(std::max(kMinSlotCount, (count + 1) * 2)), slots.get_allocator());
+    for (auto slot : slots)
+      if (slot != 0) place(grown, slot - 1, rehash(slot - 1));
+    slots = std::move(grown);
+  }
+  place(slots, id, hash);
+}
 
 auto BufferGraph::get_package(std::string_view name) const noexcept
   -> std::optional<std::reference_wrapper<const PackageNode>> {
-  auto it = name_to_package_id_.find(name);
-  if (it != name_to_package_id_.end()) return std::cref(package_nodes_[it->second]);
+  if (auto pid = find_package(name)) return std::cref(package_nodes_[*pid]);
   return std::nullopt;
 }
 
 std::pair<PackageId, bool> BufferGraph::create_package(std::string_view name) {
-  auto it = name_to_package_id_.find(name);
-  if (it != name_to_package_id_.end()) return {it->second, false};
+  auto hash = package_hash(name);
+  auto equal = [this, name](PackageId pid) { return package_nodes_[pid].name == name; };
+  if (auto found = find_slot(package_slots_, hash, equal)) return {*found, false};
   PackageId pid = package_count();
   package_nodes_.push_back({
-    .name = std::string(name)
+    .name = store(name),
+    .version_count = 0,
+    .first_version_id = version_id_range::kEndId,
+    .last_version_id = version_id_range::kEndId
   });
-  name_to_package_id_.emplace(name, pid);
+  insert_slot(package_slots_, pid, pid, hash,
+              [this](PackageId pid) { return package_hash(package_nodes_[pid].name); });
   return {pid, true};
 }
 
-std::pair<VersionId, bool> BufferGraph::create_version(PackageId pid, std::string_view version, ArchitectureType arch) {
-  auto &pnode = package_nodes_[pid];
-  for (auto vid : pnode.version_ids) {
+std::optional<PackageId> BufferGraph::find_package(std::string_view name) const noexcept {
+  return find_slot(package_slots_, package_hash(name),
+                   [this, name](PackageId pid) { return package_nodes_[pid].name == name; });
+}
+
+std::optional<VersionId> BufferGraph::find_version(PackageId pid, std::string_view version,
+                                                   ArchitectureType arch) const noexcept {
+  return find_slot(version_slots_, version_hash(pid, version, arch), [=, this](VersionId vid) {
     const auto &vnode = version_nodes_[vid];
-    if (vnode.version == version && vnode.architecture == arch) return {vid, false};
-  }
+    return vnode.package_id == pid && vnode.architecture == arch && vnode.version == version;
+  });
+}
+
+std::pair<VersionId, bool> BufferGraph::create_version(PackageId pid, std::string_view version, ArchitectureType arch,
+                                                       std::uint64_t content_hash) {
+  if (auto found = find_version(pid, version, arch)) return {*found, false};
   VersionId vid = version_count();
   version_nodes_.push_back({
-    .version = std::string(version),
-    .architecture = arch
+    .package_id = pid,
+    .version = store(version),
+    .architecture = arch,
+    .content_hash = content_hash,
+    .next_version_id = version_id_range::kEndId,
+    .dependency_count = 0,
+    .first_dependency_id = dependency_id_range::kEndId,
+    .last_dependency_id = dependency_id_range::kEndId
   });
-  pnode.version_ids.push_back(vid);
+  auto &pnode = package_nodes_[pid];
+  if (pnode.version_count++ == 0) pnode.first_version_id = vid;
+  else version_nodes_[pnode.last_version_id].next_version_id = vid;
+  pnode.last_version_id = vid;
+  insert_slot(version_slots_, vid, vid, version_hash(pid, version, arch),
+              [this](VersionId vid) { return version_hash(vid); });
   return {vid, true};
 }
 
 std::pair<DependencyId, bool> BufferGraph::create_dependency(VersionId from_vid, PackageId to_pid,
                                                              std::string_view vcons, ArchitectureType acons,
                                                              DependencyType dtype, GroupId gid) {
-  auto &fvnode = version_nodes_[from_vid];
   DependencyId did = dependency_count();
   dependency_edges_.push_back({
     .from_version_id = from_vid,
     .to_package_id = to_pid,
-    .version_constraint = std::string(vcons),
+    .version_constraint = store(vcons),
     .architecture_constraint = acons,
     .dependency_type = dtype,
-    .group = gid
+    .group = gid,
+    .next_dependency_id = dependency_id_range::kEndId
   });
-  fvnode.dependency_ids.push_back(did);
+  auto &fvnode = version_nodes_[from_vid];
+  if (fvnode.dependency_count++ == 0) fvnode.first_dependency_id = did;
+  else dependency_edges_[fvnode.last_dependency_id].next_dependency_id = did;
+  fvnode.last_dependency_id = did;
   return {did, true};
 }
 
 void BufferGraph::clear() {
+  // Shrinking empty vectors of trivially destructible nodes hands their blocks straight back.
   package_nodes_.clear();
+  package_nodes_.shrink_to_fit();
   version_nodes_.clear();
+  version_nodes_.shrink_to_fit();
   dependency_edges_.clear();
-  name_to_package_id_.clear();
-}
-
-std::size_t BufferGraph::estimated_memory_usage() const noexcept {
-  std::size_t total = sizeof(BufferGraph);
-  total += package_nodes_.size() * sizeof(PackageNode);
-  for (const auto &pnode : package_nodes_) {
-    total += pnode.name.capacity() * sizeof(char);
-    total += pnode.version_ids.capacity() * sizeof(VersionId);
-  }
-
-  total += version_nodes_.size() * sizeof(VersionNode);
-  for (const auto &vnode : version_nodes_) {
-    total += vnode.version.capacity() * sizeof(char);
-    total += vnode.dependency_ids.capacity() * sizeof(DependencyId);
-  }
-
-  total += dependency_edges_.size() * sizeof(DependencyEdge);
-  total += name_to_package_id_.bucket_count() * sizeof(void *);
-  total += name_to_package_id_.size() * (sizeof(std::pair<std::string, PackageId>) + sizeof(void *));
-  for (const auto &name : name_to_package_id_ | std::views::keys) total += name.capacity() * sizeof(char);
-  return total;
+  dependency_edges_.shrink_to_fit();
+  package_slots_.clear();
+  package_slots_.shrink_to_fit();
+  version_slots_.clear();
+  version_slots_.shrink_to_fit();
+  strings_.release();
 }
@@ -1,16 +1,59 @@
 #include "dependency_graph.hpp"
 #include <cuda_runtime.h>
+#include <array>
+#include <chrono>
+#include <future>
 #include <ranges>
+#include <shared_mutex>
+#include <span>
 #include <string>
 #include <string_view>
+#include <system_error>
+#include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "util.hpp"
 
+struct DependencyKey {
+  PackageId to_package_id;
+  // Interned constraints are equal exactly when their pool offsets are, which stay put when the pool is remapped.
+  string_handle_offset_t version_constraint_offset;
+  std::string_view version_constraint;
+  ArchitectureType architecture_constraint;
+  DependencyType dependency_type;
+};
+
+struct DependencyKeyHash {
+  bool by_handle = false;
+
+  std::size_t operator()(const DependencyKey &key) const noexcept {
+    auto seed = by_handle ? std::hash<string_handle_offset_t>{}(key.version_constraint_offset)
+                          : std::hash<std::string_view>{}(key.version_constraint);
+    seed ^= key.to_package_id + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+    return seed ^ ((key.architecture_constraint << 8 | key.dependency_type) + 0x9e3779b97f4a7c15ull
+      + (seed << 6) + (seed >> 2));
+  }
+};
+
+struct DependencyKeyEqual {
+  bool by_handle = false;
+
+  bool operator()(const DependencyKey &l, const DependencyKey &r) const noexcept {
+    if (l.to_package_id != r.to_package_id || l.architecture_constraint != r.architecture_constraint
+      || l.dependency_type != r.dependency_type || l.version_constraint.size() != r.version_constraint.size())
+      return false;
+    if (by_handle) return l.version_constraint_offset == r.version_constraint_offset;
+    return l.version_constraint == r.version_constraint;
+  }
+};
+
+using DependencyKeySet = std::unordered_set<DependencyKey, DependencyKeyHash, DependencyKeyEqual>;
+
 DependencyGraph::DependencyGraph(std::size_t memory_limit, std::size_t chunk_bytes) noexcept
-  : disk_graph_(chunk_bytes), memory_limit_(memory_limit) {}
+  : disk_graph_(chunk_bytes), buf_graph_(std::make_unique<BufferGraph>(chunk_bytes)),
+    flush_graph_(std::make_unique<BufferGraph>(chunk_bytes)), memory_limit_(memory_limit) {}
 
 DependencyGraph::DependencyGraph(const std::filesystem::path &directory_path, open_mode mode, std::size_t memory_limit,
                                  std::size_t chunk_bytes) noexcept
@@ -19,6 +62,7 @@ DependencyGraph::DependencyGraph(const std::filesystem::path &directory_path, op
 }
 
 open_code DependencyGraph::open(const std::filesystem::path &directory_path, open_mode mode) noexcept {
+  wait_flush();
   return disk_graph_.open(
     directory_path, mode, {"native", "any", "all"},
     {"Depends", "Pre-Depends", "Recommends", "Suggests", "Breaks", "Conflicts", "Provides", "Replaces", "Enhances"});
@@ -31,68 +75,186 @@ void DependencyGraph::close() {
 }
 
 void DependencyGraph::flush_buffer() {
-  disk_graph_.ingest(buf_graph_);
-  buf_graph_.clear();
+  wait_flush();
+  disk_graph_.ingest(*buf_graph_);
+  record_sources(pending_sources_);
+  disk_graph_.commit();
+  clear_buffer();
+}
+
+void DependencyGraph::flush_buffer(std::vector<VersionId> &version_ids) {
+  ingest_buffer(version_ids);
+  record_sources(pending_sources_);
+  disk_graph_.commit();
+  clear_buffer();
+}
+
+void DependencyGraph::replace_repository(std::string_view name, std::vector<VersionId> version_ids) {
+  ingest_buffer(version_ids);
+  disk_graph_.replace_repository(name, std::move(version_ids));
+  record_sources(pending_sources_);
+  disk_graph_.commit();
+  clear_buffer();
+}
+
+void DependencyGraph::flush_buffer_in_background() {
+  wait_flush();
+  {
+    std::lock_guard lock(buffer_mutex_);
+    std::swap(buf_graph_, flush_graph_);
+  }
+  pending_flush_ = std::async(std::launch::async, [this, sources = std::move(pending_sources_)]() mutable {
+    disk_graph_.ingest(*flush_graph_);
+    record_sources(sources);
+    disk_graph_.commit();
+    std::lock_guard lock(buffer_mutex_);
+    flush_graph_->clear();
+  });
+  pending_sources_.clear();
+}
+
+void DependencyGraph::wait_flush() {
+  if (pending_flush_.valid()) pending_flush_.get();
+}
+
+void DependencyGraph::ingest_buffer(std::vector<VersionId> &version_ids) {
+  wait_flush();
+  auto kept = version_ids.size();
+  version_ids.resize(kept + buf_graph_->version_count());
+  disk_graph_.ingest(*buf_graph_, std::span(version_ids).subspan(kept));
+}
+
+void DependencyGraph::clear_buffer() {
+  std::lock_guard lock(buffer_mutex_);
+  buf_graph_->clear();
+}
+
+void DependencyGraph::record_sources(std::vector<SourceFile> &sources) {
+  if (!disk_graph_.is_open() || disk_graph_.read_only()) return;
+  std::lock_guard lock(source_mutex_);
+  for (const auto &source : sources) disk_graph_.record_source(source);
+  sources.clear();
+}
+
+std::optional<SourceFile> DependencyGraph::find_source(std::uint64_t path_hash) const {
+  std::lock_guard lock(source_mutex_);
+  return disk_graph_.find_source(path_hash);
+}
+
+std::optional<VersionId> DependencyGraph::find_stanza(std::uint64_t content_hash, std::string_view package,
+                                                      std::string_view version, std::string_view architecture) const {
+  if (pending_flush_.valid() && pending_flush_.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    return std::nullopt;
+  return disk_graph_.find_stanza(content_hash, package, version, architecture);
+}
+
+void DependencyGraph::compact() {
+  flush_buffer();
+  free_gpu();
+  disk_graph_.compact();
 }
 
 bool DependencyGraph::flush_buffer_if_needed() {
-  auto needed = estimated_memory_usage() >= memory_limit_;
-  if (needed) flush_buffer();
+  auto needed = memory_usage() >= memory_limit_;
+  if (needed && background_flush_) flush_buffer_in_background();
+  else if (needed) flush_buffer();
   return needed;
 }
 
-std::size_t DependencyGraph::estimated_memory_usage() const noexcept {
-  return sizeof(DependencyGraph) + buf_graph_.estimated_memory_usage() - sizeof(BufferGraph);
+std::size_t DependencyGraph::memory_usage() const noexcept {
+  return sizeof(DependencyGraph) + buf_graph_->memory_usage();
+}
+
+// Only the loader adds symbols, so a known one is read without racing the flusher; a new one waits for its commit.
+ArchitectureType DependencyGraph::add_architecture(std::string_view arch) {
+  if (auto atype = architectures().id(arch)) return *atype;
+  wait_flush();
+  return disk_graph_.add_architecture(arch);
+}
+
+DependencyType DependencyGraph::add_dependency_type(std::string_view dtype) {
+  if (auto dtyp = dependency_types().id(dtype)) return *dtyp;
+  wait_flush();
+  return disk_graph_.add_dependency_type(dtype);
 }
 
 std::pair<PackageId, bool> DependencyGraph::create_package(std::string_view name) {
-  return buf_graph_.create_package(name);
+  if (read_only()) throw std::system_error(std::make_error_code(std::errc::read_only_file_system));
+  std::lock_guard lock(buffer_mutex_);
+  return buf_graph_->create_package(name);
 }
 
 std::pair<VersionId, bool> DependencyGraph::create_version(PackageId pid, std::string_view version,
-                                                           ArchitectureType arch) {
-  return buf_graph_.create_version(pid, version, arch);
+                                                           ArchitectureType arch, std::uint64_t content_hash) {
+  std::lock_guard lock(buffer_mutex_);
+  return buf_graph_->create_version(pid, version, arch, content_hash);
 }
 
 std::pair<DependencyId, bool> DependencyGraph::create_dependency(VersionId from_vid, PackageId to_pid,
                                                                  std::string_view vcons, ArchitectureType acons,
                                                                  DependencyType dtype, GroupId gid) {
-  return buf_graph_.create_dependency(from_vid, to_pid, vcons, acons, dtype, gid);
+  std::lock_guard lock(buffer_mutex_);
+  return buf_graph_->create_dependency(from_vid, to_pid, vcons, acons, dtype, gid);
 }
 
 DependencyResult DependencyGraph::query_dependencies(std::string_view name, std::string_view version,
                                                      std::string_view arch, std::size_t depth, bool use_gpu) const {
+  // Taken before the snapshot, so the buffers still hold whatever a flush has not committed by then.
+  std::shared_lock lock(buffer_mutex_);
+  auto pinned = std::make_shared<const DiskGraph::Snapshot>(snapshot());
+  DependencyResult result;
+  if (!use_gpu && (flush_graph_->package_count() > 0 || buf_graph_->package_count() > 0))
+    result = query_dependencies_with_buffer(*pinned, name, version, arch, depth);
+  else {
+    lock.unlock();
+    result = query_dependencies(*pinned, name, version, arch, depth, use_gpu);
+  }
+  result.snapshot = std::move(pinned);
+  return result;
+}
+
+DependencyResult DependencyGraph::query_dependencies(const DiskGraph::Snapshot &snapshot, std::string_view name,
+                                                     std::string_view version, std::string_view arch,
+                                                     std::size_t depth, bool use_gpu) const {
   std::vector<VersionId> frontier;
-  auto it = disk_graph_.name_to_package_id_.find(name);
-  if (it != disk_graph_.name_to_package_id_.end()) {
-    const auto &pnode = disk_graph_.package_nodes_[it->second];
-    for (auto vlid = pnode.version_list_id; vlid != DiskGraph::kVersionListEndId;) {
+  auto pid = disk_graph_.find_package(name, stable_hash(name), snapshot.package_count());
+  if (pid && !version.empty()) {
+    for (std::size_t atype = 0; atype < snapshot.architecture_count(); ++atype) {
+      if (!arch.empty() && architectures()[atype] != arch) continue;
+      if (auto vid = disk_graph_.find_version(*pid, version, atype, snapshot))
+        frontier.emplace_back(*vid);
+    }
+  } else if (pid) {
+    for (auto vlid = disk_graph_.version_list_head(*pid, snapshot); vlid != DiskGraph::kVersionListEndId;) {
       const auto &vlist = disk_graph_.version_lists_[vlid];
       for (auto vid = vlist.version_id_begin; vid < vlist.version_id_begin + vlist.version_count; ++vid) {
         const auto &vnode = disk_graph_.version_nodes_[vid];
-        auto vstr = disk_graph_.string_pool_.get(vnode.version_offset, vnode.version_length);
-        if (!version.empty() && vstr != version) continue;
+        if (disk_graph_.tombstoned(vid, snapshot)) continue;
         if (!arch.empty() && architectures()[vnode.architecture] != arch) continue;
         frontier.emplace_back(vid);
       }
       vlid = vlist.next_version_list_id;
     }
   }
-  return use_gpu ? query_dependencies_on_gpu(frontier, depth) : query_dependencies_on_disk(frontier, depth);
+  return use_gpu ? query_dependencies_on_gpu(frontier, depth) : query_dependencies_on_disk(snapshot, frontier, depth);
 }
 
 DependencyResult DependencyGraph::query_dependencies_on_buffer(std::string_view name, std::string_view version,
                                                                std::string_view arch, std::size_t depth) const {
   DependencyResult result(depth);
   std::vector<VersionId> frontier;
-  auto opt = buf_graph_.get_package(name);
-  if (!opt.has_value()) return result;
-  for (auto vid : opt->get().version_ids) {
-    const auto &vnode = buf_graph_.get_version(vid);
-    if (!version.empty() && vnode.version != version) continue;
-    if (!arch.empty() && architectures()[vnode.architecture] != arch) continue;
-    frontier.emplace_back(vid);
-  }
+  auto pid = buf_graph_->find_package(name);
+  if (!pid) return result;
+  if (!version.empty())
+    for (std::size_t atype = 0; atype < architecture_count(); ++atype) {
+      if (!arch.empty() && architectures()[atype] != arch) continue;
+      if (auto vid = buf_graph_->find_version(*pid, version, atype)) frontier.emplace_back(*vid);
+    }
+  else
+    for (auto vid : buf_graph_->version_ids(*pid)) {
+      if (!arch.empty() && architectures()[buf_graph_->get_version(vid).architecture] != arch) continue;
+      frontier.emplace_back(vid);
+    }
   if (frontier.empty()) return result;
   std::unordered_set visited_vids(frontier.begin(), frontier.end());
 
@@ -101,13 +263,13 @@ DependencyResult DependencyGraph::query_dependencies_on_buffer(std::string_view
     std::vector<VersionId> next;
 
     for (auto vid : frontier) {
-      const auto &vnode = buf_graph_.get_version(vid);
+      const auto &vnode = buf_graph_->get_version(vid);
       std::vector<DependencyGroup> vgroups;
       std::vector<std::unordered_set<DependencyItem>> visited_group_items;
 
-      for (auto did : vnode.dependency_ids) {
-        const auto &dedge = buf_graph_.get_dependency(did);
-        const auto &tpnode = buf_graph_.get_package(dedge.to_package_id);
+      for (auto did : buf_graph_->dependency_ids(vid)) {
+        const auto &dedge = buf_graph_->get_dependency(did);
+        const auto &tpnode = buf_graph_->get_package(dedge.to_package_id);
         DependencyItem item{
           .package_name = tpnode.name,
           .dependency_type = dependency_types()[dedge.dependency_type],
@@ -126,9 +288,9 @@ DependencyResult DependencyGraph::query_dependencies_on_buffer(std::string_view
           result[level].direct_dependencies.emplace_back(std::move(item));
 
         if (level + 1 < depth && dependency_types()[dedge.dependency_type] == "Depends" && dedge.group == 0)
-          for (auto nvid : tpnode.version_ids) {
+          for (auto nvid : buf_graph_->version_ids(dedge.to_package_id)) {
             if (visited_vids.contains(nvid)) continue;
-            const auto &nvnode = buf_graph_.get_version(nvid);
+            const auto &nvnode = buf_graph_->get_version(nvid);
 
             bool match = false;
             if (architectures()[dedge.architecture_constraint] == "native")
@@ -150,47 +312,232 @@ DependencyResult DependencyGraph::query_dependencies_on_buffer(std::string_view
   return result;
 }
 
-DependencyResult DependencyGraph::query_dependencies_on_disk(std::vector<VersionId> &frontier,
+// Layer 0 is the snapshot, then come the buffer a background flush is ingesting and the live buffer. Versions are
+// numbered across the layers in that order, and packages are matched across them by name.
+DependencyResult DependencyGraph::query_dependencies_with_buffer(const DiskGraph::Snapshot &snapshot,
+                                                                 std::string_view name, std::string_view version,
+                                                                 std::string_view arch, std::size_t depth) const {
+  DependencyResult result(depth);
+  VersionId flush_vid_begin = snapshot.version_count();
+  VersionId live_vid_begin = flush_vid_begin + flush_graph_->version_count();
+  const std::array<std::pair<const BufferGraph *, VersionId>, 2> buffers{{
+    {flush_graph_.get(), flush_vid_begin}, {buf_graph_.get(), live_vid_begin}
+  }};
+
+  struct OverlayPackage {
+    std::optional<PackageId> pid;
+    std::array<std::optional<PackageId>, 2> bpids;
+  };
+  std::unordered_map<std::string_view, OverlayPackage> packages;
+  auto find_package = [&](std::string_view pname) -> const OverlayPackage & {
+    auto [it, inserted] = packages.try_emplace(pname);
+    if (inserted) {
+      it->second.pid = disk_graph_.find_package(pname, stable_hash(pname), snapshot.package_count());
+      for (std::size_t layer = 0; layer < buffers.size(); ++layer)
+        it->second.bpids[layer] = buffers[layer].first->find_package(pname);
+    }
+    return it->second;
+  };
+  // The version of a package a flush of each layer in turn would keep: a buffered version replaces an earlier one,
+  // unless it was created without a content hash.
+  auto resolve = [&](const OverlayPackage &package, std::string_view ver, ArchitectureType atype) {
+    auto vid = package.pid ? disk_graph_.find_version(*package.pid, ver, atype, snapshot) : std::nullopt;
+    for (std::size_t layer = 0; layer < buffers.size(); ++layer) {
+      auto [buffer, vid_begin] = buffers[layer];
+      if (auto bvid = package.bpids[layer] ? buffer->find_version(*package.bpids[layer], ver, atype) : std::nullopt)
+        if (!vid || buffer->get_version(*bvid).content_hash) vid = vid_begin + *bvid;
+    }
+    return vid;
+  };
+  auto for_each_version = [&](const OverlayPackage &package, auto &&fn) {
+    bool buffered = package.bpids[0] || package.bpids[1];
+    if (package.pid)
+      for (auto vlid = disk_graph_.version_list_head(*package.pid, snapshot); vlid != DiskGraph::kVersionListEndId;) {
+        const auto &vlist = disk_graph_.version_lists_[vlid];
+        for (auto vid = vlist.version_id_begin; vid < vlist.version_id_begin + vlist.version_count; ++vid) {
+          if (disk_graph_.tombstoned(vid, snapshot)) continue;
+          const auto &vnode = disk_graph_.version_nodes_[vid];
+          if (buffered) {
+            auto ver = pool_string(result, vnode.version_offset, vnode.version_length);
+            if (resolve(package, ver, vnode.architecture) != vid) continue;
+          }
+          fn(vid, vnode.architecture);
+        }
+        vlid = vlist.next_version_list_id;
+      }
+    for (std::size_t layer = 0; layer < buffers.size(); ++layer) {
+      auto [buffer, vid_begin] = buffers[layer];
+      if (package.bpids[layer])
+        for (auto bvid : buffer->version_ids(*package.bpids[layer])) {
+          const auto &bvnode = buffer->get_version(bvid);
+          if (resolve(package, bvnode.version, bvnode.architecture) == vid_begin + bvid)
+            fn(vid_begin + bvid, bvnode.architecture);
+        }
+    }
+  };
+
+  std::vector<VersionId> frontier;
+  const auto &root = find_package(name);
+  if (!version.empty())
+    for (std::size_t atype = 0; atype < architecture_count(); ++atype) {
+      if (!arch.empty() && architectures()[atype] != arch) continue;
+      if (auto vid = resolve(root, version, atype)) frontier.emplace_back(*vid);
+    }
+  else
+    for_each_version(root, [&](VersionId vid, ArchitectureType atype) {
+      if (arch.empty() || architectures()[atype] == arch) frontier.emplace_back(vid);
+    });
+  if (frontier.empty()) return result;
+  std::unordered_set visited_vids(frontier.begin(), frontier.end());
+
+  for (std::size_t level = 0; level < depth; ++level) {
+    std::unordered_set<DependencyItem> visited_direct_items;
+    std::vector<VersionId> next;
+
+    for (auto vid : frontier) {
+      std::vector<DependencyGroup> vgroups;
+      std::vector<std::unordered_set<DependencyItem>> visited_group_items;
+      const BufferGraph *buffer = nullptr;
+      VersionId bvid = 0;
+      for (auto [candidate, vid_begin] : buffers)
+        if (vid >= vid_begin) {
+          buffer = candidate;
+          bvid = vid - vid_begin;
+        }
+      auto varch = buffer ? buffer->get_version(bvid).architecture : disk_graph_.version_nodes_[vid].architecture;
+
+      auto visit = [&](const DependencyItem &item, ArchitectureType acons, GroupId group) {
+        // Buffered strings are copied once kept, since the buffer is cleared after it is flushed.
+        auto kept = [&] {
+          if (!buffer) return item;
+          auto copy = item;
+          copy.package_name = buffer_string(result, item.package_name);
+          copy.version_constraint = buffer_string(result, item.version_constraint);
+          return copy;
+        };
+        if (group > 0) {
+          if (vgroups.size() < group) {
+            vgroups.resize(group);
+            visited_group_items.resize(group);
+          }
+          if (visited_group_items[group - 1].emplace(item).second) vgroups[group - 1].emplace_back(kept());
+        } else if (visited_direct_items.emplace(item).second) result[level].direct_dependencies.emplace_back(kept());
+
+        if (level + 1 < depth && item.dependency_type == "Depends" && group == 0)
+          for_each_version(find_package(item.package_name), [&](VersionId nvid, ArchitectureType narch) {
+            if (visited_vids.contains(nvid)) return;
+            bool match = false;
+            if (item.architecture_constraint == "native")
+              match = narch == varch || architectures()[narch] == "all";
+            else if (item.architecture_constraint == "any") match = true;
+            else match = narch == acons;
+
+            if (match) {
+              next.emplace_back(nvid);
+              visited_vids.emplace(nvid);
+            }
+          });
+      };
+
+      if (!buffer) {
+        const auto &vnode = disk_graph_.version_nodes_[vid];
+        for (auto did = vnode.dependency_id_begin; did < vnode.dependency_id_begin + vnode.dependency_count; ++did) {
+          const auto &dedge = disk_graph_.dependency_edges_[did];
+          const auto &tpnode = disk_graph_.package_nodes_[dedge.to_package_id];
+          visit({
+            .package_name = pool_string(result, tpnode.name_offset, tpnode.name_length),
+            .dependency_type = dependency_types()[dedge.dependency_type],
+            .version_constraint = pool_string(
+              result, dedge.version_constraint_offset, dedge.version_constraint_length),
+            .architecture_constraint = architectures()[dedge.architecture_constraint]
+          }, dedge.architecture_constraint, dedge.group);
+        }
+      } else
+        for (auto did : buffer->dependency_ids(bvid)) {
+          const auto &dedge = buffer->get_dependency(did);
+          visit({
+            .package_name = buffer->get_package(dedge.to_package_id).name,
+            .dependency_type = dependency_types()[dedge.dependency_type],
+            .version_constraint = dedge.version_constraint,
+            .architecture_constraint = architectures()[dedge.architecture_constraint]
+          }, dedge.architecture_constraint, dedge.group);
+        }
+      for (auto &group : vgroups) if (!group.empty()) result[level].or_dependencies.emplace_back(std::move(group));
+    }
+    frontier = std::move(next);
+    if (frontier.empty()) break;
+  }
+  return result;
+}
+
+std::string_view DependencyGraph::pool_string(DependencyResult &result, string_handle_offset_t offset,
+                                              string_handle_length_t length) const {
+  const auto &pool = disk_graph_.string_pool_;
+  if (!pool.compressed()) return pool.get(offset, length);
+  if (!result.strings) result.strings = std::make_shared<decltype(result.strings)::element_type>();
+  auto [it, inserted] = result.strings->try_emplace(std::uint64_t(offset) << 8 * sizeof(length) | length);
+  if (inserted) pool.get({.offset = offset, .length = length}, it->second);
+  return it->second;
+}
+
+std::string_view DependencyGraph::buffer_string(DependencyResult &result, std::string_view str) {
+  if (!result.buffered_strings)
+    result.buffered_strings = std::make_shared<decltype(result.buffered_strings)::element_type>();
+  return *result.buffered_strings->emplace(str).first;
+}
+
+DependencyResult DependencyGraph::query_dependencies_on_disk(const DiskGraph::Snapshot &snapshot,
+                                                             std::vector<VersionId> &frontier,
                                                              std::size_t depth) const {
   DependencyResult result(depth);
   if (frontier.empty()) return result;
   std::unordered_set visited_vids(frontier.begin(), frontier.end());
+  bool by_handle = snapshot.strings_interned();
+  DependencyKeySet empty_keys(0, DependencyKeyHash{by_handle}, DependencyKeyEqual{by_handle});
 
   for (auto level = 0; level < depth; ++level) {
-    std::unordered_set<DependencyItem> visited_direct_items;
+    auto visited_direct_keys = empty_keys;
     std::vector<VersionId> next;
 
     for (auto vid : frontier) {
       const auto &vnode = disk_graph_.version_nodes_[vid];
       std::vector<DependencyGroup> vgroups;
-      std::vector<std::unordered_set<DependencyItem>> visited_group_items;
+      std::vector<DependencyKeySet> visited_group_keys;
 
       for (auto did = vnode.dependency_id_begin; did < vnode.dependency_id_begin + vnode.dependency_count; ++did) {
         const auto &dedge = disk_graph_.dependency_edges_[did];
         const auto &tpnode = disk_graph_.package_nodes_[dedge.to_package_id];
-        DependencyItem item{
-          .package_name = disk_graph_.string_pool_.get(tpnode.name_offset, tpnode.name_length),
-          .dependency_type = dependency_types()[dedge.dependency_type],
-          .version_constraint = disk_graph_.string_pool_.get(
-            dedge.version_constraint_offset, dedge.version_constraint_length),
-          .architecture_constraint = architectures()[dedge.architecture_constraint]
+        DependencyKey key{
+          .to_package_id = dedge.to_package_id,
+          .version_constraint_offset = dedge.version_constraint_offset,
+          .version_constraint = pool_string(
+            result, dedge.version_constraint_offset, dedge.version_constraint_length),
+          .architecture_constraint = dedge.architecture_constraint,
+          .dependency_type = dedge.dependency_type
+        };
+        auto to_item = [&] {
+          return DependencyItem{
+            .package_name = pool_string(result, tpnode.name_offset, tpnode.name_length),
+            .dependency_type = dependency_types()[dedge.dependency_type],
+            .version_constraint = key.version_constraint,
+            .architecture_constraint = architectures()[dedge.architecture_constraint]
+          };
         };
 
         if (dedge.group > 0) {
           if (vgroups.size() < dedge.group) {
             vgroups.resize(dedge.group);
-            visited_group_items.resize(dedge.group);
+            visited_group_keys.resize(dedge.group, empty_keys);
           }
-          if (visited_group_items[dedge.group - 1].emplace(item).second)
-            vgroups[dedge.group - 1].emplace_back(std::move(item));
-        } else if (visited_direct_items.emplace(item).second)
-          result[level].direct_dependencies.emplace_back(std::move(item));
+          if (visited_group_keys[dedge.group - 1].emplace(key).second) vgroups[dedge.group - 1].emplace_back(to_item());
+        } else if (visited_direct_keys.emplace(key).second) result[level].direct_dependencies.emplace_back(to_item());
 
         if (level + 1 < depth && dependency_types()[dedge.dependency_type] == "Depends" && dedge.group == 0)
-          for (auto vlid = tpnode.version_list_id; vlid != DiskGraph::kVersionListEndId;) {
+          for (auto vlid = disk_graph_.version_list_head(dedge.to_package_id, snapshot);
+               vlid != DiskGraph::kVersionListEndId;) {
             const auto &vlist = disk_graph_.version_lists_[vlid];
             for (auto nvid = vlist.version_id_begin; nvid < vlist.version_id_begin + vlist.version_count; ++nvid) {
-              if (visited_vids.contains(nvid)) continue;
+              if (visited_vids.contains(nvid) || disk_graph_.tombstoned(nvid, snapshot)) continue;
               const auto &nvnode = disk_graph_.version_nodes_[nvid];
 
               bool match = false;
@@ -265,6 +612,8 @@ DependencyResult DependencyGraph::query_dependencies_on_gpu(std::vector<VersionI
   if (frontier.empty()) return result;
   std::size_t frontier_size = frontier.size(), dependency_count;
   std::vector<DependencyId> dependency_ids_;
+  bool by_handle = disk_graph_.strings_interned();
+  DependencyKeySet empty_keys(0, DependencyKeyHash{by_handle}, DependencyKeyEqual{by_handle});
   for (auto &vid : frontier) vid = gpu_graph_.to_gpu_version_id_[vid];
   cudaMemcpy(gpu_graph_.d_frontier_, frontier.data(), frontier_size * sizeof(VersionId), cudaMemcpyHostToDevice);
 
@@ -286,31 +635,37 @@ DependencyResult DependencyGraph::query_dependencies_on_gpu(std::vector<VersionI
                cudaMemcpyDeviceToHost);
 
     std::unordered_map<VersionId, std::vector<DependencyGroup>> groups_by_version;
-    std::unordered_set<DependencyItem> visited_direct_items;
-    std::unordered_map<VersionId, std::vector<std::unordered_set<DependencyItem>>> visited_group_items_by_version;
+    auto visited_direct_keys = empty_keys;
+    std::unordered_map<VersionId, std::vector<DependencyKeySet>> visited_group_keys_by_version;
     for (auto did : dependency_ids_) {
       const auto &dedge = disk_graph_.dependency_edges_[did];
       const auto &tpnode = disk_graph_.package_nodes_[dedge.to_package_id];
-      DependencyItem item{
-        .package_name = disk_graph_.string_pool_.get(tpnode.name_offset, tpnode.name_length),
-        .dependency_type = dependency_types()[dedge.dependency_type],
-        .version_constraint = disk_graph_.string_pool_.get(
-          dedge.version_constraint_offset, dedge.version_constraint_length),
-        .architecture_constraint = architectures()[dedge.architecture_constraint]
+      DependencyKey key{
+        .to_package_id = dedge.to_package_id,
+        .version_constraint_offset = dedge.version_constraint_offset,
+        .version_constraint = pool_string(result, dedge.version_constraint_offset, dedge.version_constraint_length),
+        .architecture_constraint = dedge.architecture_constraint,
+        .dependency_type = dedge.dependency_type
+      };
+      auto to_item = [&] {
+        return DependencyItem{
+          .package_name = pool_string(result, tpnode.name_offset, tpnode.name_length),
+          .dependency_type = dependency_types()[dedge.dependency_type],
+          .version_constraint = key.version_constraint,
+          .architecture_constraint = architectures()[dedge.architecture_constraint]
+        };
       };
 
       if (dedge.group > 0) {
         auto vid = dedge.from_version_id;
         auto &vgroups = groups_by_version[vid];
-        auto &visited_group_items = visited_group_items_by_version[vid];
+        auto &visited_group_keys = visited_group_keys_by_version[vid];
         if (dedge.group > vgroups.size()) {
           vgroups.resize(dedge.group);
-          visited_group_items.resize(dedge.group);
+          visited_group_keys.resize(dedge.group, empty_keys);
         }
-        if (visited_group_items[dedge.group - 1].emplace(item).second)
-          vgroups[dedge.group - 1].emplace_back(std::move(item));
-      } else if (visited_direct_items.emplace(item).second)
-        result[level].direct_dependencies.emplace_back(std::move(item));
+        if (visited_group_keys[dedge.group - 1].emplace(key).second) vgroups[dedge.group - 1].emplace_back(to_item());
+      } else if (visited_direct_keys.emplace(key).second) result[level].direct_dependencies.emplace_back(to_item());
     }
 
     for (auto &vgroups : groups_by_version | std::views::values)
@@ -1,10 +1,54 @@
 #include "disk_graph.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 #include "buffer_graph.hpp"
+#include "crc32c.hpp"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 DiskGraph::DiskGraph(std::size_t chunk_bytes) noexcept
-  : control_(kSmallChunkBytes), architectures_(kSmallChunkBytes), dependency_types_(kSmallChunkBytes),
-    package_nodes_(chunk_bytes), version_nodes_(chunk_bytes), dependency_edges_(chunk_bytes),
-    version_lists_(chunk_bytes), string_pool_(chunk_bytes), name_to_package_id_(0, string_pool_, string_pool_) {}
+  : control_(kSmallChunkBytes),
+    architectures_(kSmallChunkBytes),
+    dependency_types_(kSmallChunkBytes),
+    package_nodes_(chunk_bytes),
+    version_nodes_(chunk_bytes),
+    dependency_edges_(chunk_bytes),
+    version_lists_(chunk_bytes),
+    version_packages_(chunk_bytes),
+    journal_(kSmallChunkBytes),
+    string_pool_(chunk_bytes),
+    string_index_(chunk_bytes),
+    name_index_(chunk_bytes),
+    version_index_(chunk_bytes),
+    checksums_(kSmallChunkBytes),
+    repositories_(kSmallChunkBytes),
+    repository_versions_(kSmallChunkBytes),
+    tombstone_log_(kSmallChunkBytes),
+    tombstones_(kSmallChunkBytes),
+    sources_(kSmallChunkBytes),
+    stanza_index_(kSmallChunkBytes),
+    ingest_threads_(std::max(std::thread::hardware_concurrency(), 1u)) {
+  dependency_edges_.set_advice(kAdviceRandom);
+  version_nodes_.set_advice(kAdviceRandom);
+  string_index_.set_advice(kAdviceRandom);
+  name_index_.set_advice(kAdviceRandom);
+  version_index_.set_advice(kAdviceRandom);
+  stanza_index_.set_advice(kAdviceRandom);
+}
 
 DiskGraph::DiskGraph(const std::filesystem::path &directory_path, open_mode mode,
                      std::initializer_list<std::string_view> architectures,
@@ -13,47 +57,573 @@ DiskGraph::DiskGraph(const std::filesystem::path &directory_path, open_mode mode
   open(directory_path, mode, architectures, dependency_types);
 }
 
+std::size_t DiskGraph::control_checksum(const Control &control) noexcept {
+  std::string_view bytes(reinterpret_cast<const char *>(&control), offsetof(Control, checksum));
+  auto checksum = static_cast<std::size_t>(stable_hash(bytes));
+  return checksum ? checksum : 1;
+}
+
+bool DiskGraph::valid_control(const Control &control) noexcept {
+  if (control.magic != kMagicNumber) return false;
+  return control.checksum == control_checksum(control) || (control.checksum == 0 && control.sequence == 0);
+}
+
+bool DiskGraph::select_control() noexcept {
+  bool found = false;
+  for (std::size_t slot = 0; slot < kControlSlotCount; ++slot) {
+    if (!valid_control(control_slot(slot))) continue;
+    if (!found || control_slot(slot).sequence > control().sequence) active_control_ = slot;
+    found = true;
+  }
+  return found;
+}
+
+auto DiskGraph::current_control() const noexcept -> Control {
+  return {
+    .magic = kMagicNumber,
+    .architecture_count = architecture_count(),
+    .dependency_type_count = dependency_type_count(),
+    .package_count = package_count(),
+    .version_count = version_count(),
+    .dependency_count = dependency_count(),
+    .version_list_count = version_lists_.size(),
+    .string_pool_size = string_pool_.size(),
+    .flags = control().flags,
+    .sequence = control().sequence + 1,
+    .checksum = 0,
+  };
+}
+
+void DiskGraph::write_control() {
+  auto slot = (active_control_ + 1) % kControlSlotCount;
+  auto next = current_control();
+  next.checksum = control_checksum(next);
+  // A snapshot may still be copying this slot from two commits ago; word-sized atomic stores leave it a torn but
+  // well-defined copy that fails its checksum.
+  auto *words = reinterpret_cast<std::size_t *>(&mutable_control_slot(slot));
+  const auto *source = reinterpret_cast<const std::size_t *>(&next);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (std::size_t i = 0; i < control_size() / sizeof(std::size_t); ++i)
+    std::atomic_ref(words[i]).store(source[i], std::memory_order_relaxed);
+  active_control_.store(slot, std::memory_order_release);
+}
+
 bool DiskGraph::validate_control() const noexcept {
-  if (control().magic != kMagicNumber) return false;
-  if (control().architecture_count != architecture_count()) return false;
-  if (control().dependency_type_count != dependency_type_count()) return false;
-  if (control().package_count != package_count()) return false;
-  if (control().version_count != version_count()) return false;
-  if (control().dependency_count != dependency_count()) return false;
-  if (control().version_list_count != version_lists_.size()) return false;
-  if (control().string_pool_size != string_pool_.size()) return false;
+  if (control().architecture_count > architectures_.size()) return false;
+  if (control().dependency_type_count > dependency_types_.size()) return false;
+  if (control().package_count > package_nodes_.size()) return false;
+  if (control().version_count > version_nodes_.size()) return false;
+  if (control().dependency_count > dependency_edges_.size()) return false;
+  if (control().version_list_count > version_lists_.size()) return false;
+  if (control().string_pool_size > string_pool_.size()) return false;
   return true;
 }
 
-bool DiskGraph::load(const std::filesystem::path &directory_path) noexcept {
+bool DiskGraph::has_uncommitted_tail() const noexcept {
+  const auto &committed = control();
+  return architectures_.size() != committed.architecture_count
+    || dependency_types_.size() != committed.dependency_type_count || package_nodes_.size() != committed.package_count
+    || version_nodes_.size() != committed.version_count || dependency_edges_.size() != committed.dependency_count
+    || version_lists_.size() != committed.version_list_count || string_pool_.size() != committed.string_pool_size
+    || version_packages_.size() > committed.version_count || !journal_.empty()
+    || committed_size(repositories_, committed.sequence) != repositories_.size()
+    || committed_size(tombstone_log_, committed.sequence) != tombstone_log_.size()
+    || committed_size(sources_, committed.sequence) != sources_.size()
+    || (repositories_.empty() ? 0 : repositories_.back().version_begin + repositories_.back().version_count)
+      != repository_versions_.size();
+}
+
+template <class Log>
+std::size_t DiskGraph::committed_size(const Log &log, std::size_t sequence) noexcept {
+  auto it = std::partition_point(log.begin(), log.end(), [sequence](const auto &entry) {
+    return entry.sequence <= sequence;
+  });
+  return it - log.begin();
+}
+
+template <class Log>
+std::size_t DiskGraph::visible_size(const Log &log) const noexcept {
+  return read_only() ? committed_size(log, control().sequence) : log.size();
+}
+
+std::size_t DiskGraph::tombstone_count() const noexcept { return visible_size(tombstone_log_); }
+
+void DiskGraph::recover() {
+  if (!has_uncommitted_tail()) return;
+  const auto &committed = control();
+  for (auto it = journal_.rbegin(); it != journal_.rend(); ++it)
+    if (it->sequence > committed.sequence && it->package_id < committed.package_count)
+      package_nodes_[it->package_id].version_list_id = it->version_list_id;
+  architectures_.truncate(committed.architecture_count);
+  dependency_types_.truncate(committed.dependency_type_count);
+  package_nodes_.resize(committed.package_count);
+  version_nodes_.resize(committed.version_count);
+  dependency_edges_.resize(committed.dependency_count);
+  version_lists_.resize(committed.version_list_count);
+  if (version_packages_.size() > committed.version_count) version_packages_.resize(committed.version_count);
+  string_pool_.resize(committed.string_pool_size);
+  repositories_.resize(committed_size(repositories_, committed.sequence));
+  repository_versions_.resize(
+    repositories_.empty() ? 0 : repositories_.back().version_begin + repositories_.back().version_count);
+  if (auto count = committed_size(tombstone_log_, committed.sequence); count != tombstone_log_.size()) {
+    tombstone_log_.resize(count);
+    rebuild_tombstones();
+  }
+  sources_.resize(committed_size(sources_, committed.sequence));
+  // Rolled-back ids are handed out again, so stanza entries written after the commit may name other versions.
+  stanza_index_.clear();
+  package_nodes_.sync(kSyncFull);
+  repositories_.sync(kSyncFull);
+  repository_versions_.sync(kSyncFull);
+  tombstone_log_.sync(kSyncFull);
+  tombstones_.sync(kSyncFull);
+  sources_.sync(kSyncFull);
+  stanza_index_.sync(kSyncFull);
+  // An interrupted commit may have rewritten the tail blocks and journaled package blocks of the sidecar. A short
+  // version-packages file is rebuilt by load(), which then rewrites every checksum.
+  if (version_packages_.size() == committed.version_count) {
+    update_checksums(committed, committed);
+    checksums_.sync(kSyncFull);
+  }
+  journal_.clear();
+  journal_.sync(kSyncFull);
+}
+
+auto DiskGraph::checksum_sections(const Control &control) const noexcept -> ChecksumSections {
+  auto bytes = [](const auto *data, std::size_t count) {
+    return std::span(reinterpret_cast<const std::byte *>(data), count * sizeof(*data));
+  };
+  return {
+    bytes(architectures_.data(), architectures_.symbol_bytes(control.architecture_count)),
+    bytes(dependency_types_.data(), dependency_types_.symbol_bytes(control.dependency_type_count)),
+    bytes(package_nodes_.data(), control.package_count),
+    bytes(version_nodes_.data(), control.version_count),
+    bytes(dependency_edges_.data(), control.dependency_count),
+    bytes(version_lists_.data(), control.version_list_count),
+    bytes(version_packages_.data(), control.version_count),
+    bytes(string_pool_.data(), control.string_pool_size),
+  };
+}
+
+std::uint32_t DiskGraph::committed_block_checksum(ChecksumSection section, std::span<const std::byte> block,
+                                                  std::size_t offset, const Control &committed) const {
+  if (section != kChecksumPackages || journal_.empty()) return crc32c(block.data(), block.size());
+  // Heads of committed packages may already point at uncommitted lists; checksum the heads the journal restores.
+  std::vector<std::byte> restored(block.begin(), block.end());
+  for (auto it = journal_.rbegin(); it != journal_.rend(); ++it) {
+    if (it->sequence <= committed.sequence || it->package_id >= committed.package_count) continue;
+    auto field = it->package_id * sizeof(PackageNode) + offsetof(PackageNode, version_list_id);
+    const auto *value = reinterpret_cast<const std::byte *>(&it->version_list_id);
+    for (std::size_t i = 0; i < sizeof(VersionListId); ++i)
+      if (field + i >= offset && field + i < offset + block.size()) restored[field + i - offset] = value[i];
+  }
+  return crc32c(restored.data(), restored.size());
+}
+
+void DiskGraph::update_checksums(const Control &previous, const Control &next) {
+  auto from = checksum_sections(previous);
+  auto to = checksum_sections(next);
+  std::size_t rows = 0;
+  for (auto bytes : to) rows = std::max(rows, (bytes.size() + kChecksumBlockBytes - 1) / kChecksumBlockBytes);
+  if (checksums_.size() < rows) checksums_.resize(rows);
+  auto update = [this, &to](std::size_t section, std::size_t block) {
+    auto offset = block * kChecksumBlockBytes;
+    auto bytes = to[section].subspan(offset, std::min(kChecksumBlockBytes, to[section].size() - offset));
+    checksums_[block].crc[section] = crc32c(bytes.data(), bytes.size());
+  };
+  for (std::size_t section = 0; section < kChecksumSectionCount; ++section)
+    for (auto block = from[section].size() / kChecksumBlockBytes; block * kChecksumBlockBytes < to[section].size();
+         ++block)
+      update(section, block);
+  for (const auto &entry : std::as_const(journal_))
+    if (entry.package_id < std::min(previous.package_count, next.package_count))
+      update(kChecksumPackages, entry.package_id * sizeof(PackageNode) / kChecksumBlockBytes);
+}
+
+bool DiskGraph::verify(std::stop_token stop) {
+  std::lock_guard pass(verify_mutex_);
+  {
+    std::lock_guard lock(checksum_mutex_);
+    verify_report_ = {.state = checksums_.is_open() ? kVerifyRunning : kVerifyUnavailable, .verified_blocks = 0,
+                      .corrupt_blocks = {}};
+    if (!checksums_.is_open()) return true;
+  }
+  for (std::size_t section = 0; section < kChecksumSectionCount; ++section)
+    for (std::size_t block = 0;; ++block) {
+      std::lock_guard lock(checksum_mutex_);
+      if (stop.stop_requested()) {
+        verify_report_.state = kVerifyPending;
+        return verify_report_.corrupt_blocks.empty();
+      }
+      // Holding the mutex keeps the committed counts, the sidecar and the journaled heads of one commit together.
+      auto committed = snapshot();
+      auto bytes = checksum_sections(committed.control_)[section];
+      auto offset = block * kChecksumBlockBytes;
+      if (offset >= bytes.size()) break;
+      auto length = std::min(kChecksumBlockBytes, bytes.size() - offset);
+      auto crc = committed_block_checksum(static_cast<ChecksumSection>(section), bytes.subspan(offset, length), offset,
+                                          committed.control_);
+      if (block < checksums_.size() && std::as_const(checksums_)[block].crc[section] == crc)
+        ++verify_report_.verified_blocks;
+      else
+        verify_report_.corrupt_blocks.push_back({.file = kChecksumFiles[section], .offset = offset, .length = length});
+    }
+  std::lock_guard lock(checksum_mutex_);
+  verify_report_.state = verify_report_.corrupt_blocks.empty() ? kVerifyPassed : kVerifyFailed;
+  return verify_report_.state == kVerifyPassed;
+}
+
+void DiskGraph::start_verifier() noexcept {
+  if (!checksums_.is_open()) verify_report_.state = kVerifyUnavailable;
+  if (!background_verify_ || !checksums_.is_open()) return;
+  try {
+    verifier_ = std::jthread([this](std::stop_token stop) {
+#if defined(_WIN32)
+      ::SetThreadPriority(::GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#elif defined(SCHED_IDLE)
+      sched_param param{};
+      ::pthread_setschedparam(::pthread_self(), SCHED_IDLE, &param);
+#endif
+      verify(stop);
+    });
+  } catch (const std::system_error &) {
+  }
+}
+
+GraphStats DiskGraph::stats() const {
+  GraphStats stats;
+  if (!is_open()) return stats;
+  auto committed = snapshot();
+  stats.sequence = committed.sequence();
+  stats.package_count = committed.package_count();
+  stats.version_count = committed.version_count();
+  stats.dependency_count = committed.dependency_count();
+  stats.tombstone_count = committed_size(tombstone_log_, committed.sequence());
+  auto count = [&stats](const auto &file) { stats.file_bytes += file.size_bytes(); };
+  count(package_nodes_);
+  count(version_nodes_);
+  count(dependency_edges_);
+  count(version_lists_);
+  count(version_packages_);
+  count(string_pool_);
+  count(string_index_);
+  count(name_index_);
+  count(version_index_);
+  count(repositories_);
+  count(repository_versions_);
+  count(tombstone_log_);
+  count(tombstones_);
+  count(sources_);
+  count(stanza_index_);
+  stats.resident_fraction = resident_fraction();
+  std::lock_guard lock(checksum_mutex_);
+  stats.verification = verify_report_;
+  return stats;
+}
+
+std::filesystem::path DiskGraph::staging_path(const std::filesystem::path &directory_path) {
+  auto path = directory_path;
+  return path += ".compact";
+}
+
+std::filesystem::path DiskGraph::retired_path(const std::filesystem::path &directory_path) {
+  auto path = directory_path;
+  return path += ".old";
+}
+
+bool DiskGraph::load(const std::filesystem::path &directory_path, bool read_only) noexcept {
   using enum open_mode;
   using enum open_code;
-  std::string dir = directory_path.string();
-  if (control_.open(dir + "/.meta", kLoad) != kLoadSuccess) return false;
-  if (control_.size() < control_size()) {
+  std::error_code error;
+  if (read_only && std::filesystem::is_regular_file(directory_path, error)) return load_packed(directory_path);
+  // A compaction that crashed between its renames left only the old graph, under its retired name, complete.
+  auto path = directory_path;
+  if (!std::filesystem::exists(path, error) && std::filesystem::is_directory(retired_path(path), error)) {
+    if (read_only) path = retired_path(path);
+    else {
+      std::filesystem::remove_all(staging_path(path), error);
+      std::filesystem::rename(retired_path(path), path, error);
+      if (error) return false;
+    }
+  }
+  std::string dir = path.string();
+  auto mode = read_only ? kReadOnly : kLoad;
+  auto derived_mode = read_only ? kReadOnly : kLoadOrCreate;
+  if (control_.open(dir + "/.meta", mode) != kLoadSuccess) return false;
+  if (control_.size() < kLegacyControlSize) {
     control_.close();
     return false;
   }
-  if (architectures_.open(dir + "/architectures.dat", kLoad) != kLoadSuccess) return false;
-  if (dependency_types_.open(dir + "/dependency-types.dat", kLoad) != kLoadSuccess) return false;
-  if (package_nodes_.open(dir + "/packages.dat", kLoad) != kLoadSuccess) return false;
-  if (version_nodes_.open(dir + "/versions.dat", kLoad) != kLoadSuccess) return false;
-  if (dependency_edges_.open(dir + "/dependencies.dat", kLoad) != kLoadSuccess) return false;
-  if (version_lists_.open(dir + "/version-lists.dat", kLoad) != kLoadSuccess) return false;
-  if (string_pool_.open(dir + "/string-pool.dat", kLoad) != kLoadSuccess) return false;
+  if (control_.size() < kControlSlotCount * control_size()) {
+    if (read_only) return false;
+    control_.resize(kControlSlotCount * control_size());
+  }
+  if (!select_control()) return false;
+  if (architectures_.open(dir + "/architectures.dat", mode) != kLoadSuccess) return false;
+  if (dependency_types_.open(dir + "/dependency-types.dat", mode) != kLoadSuccess) return false;
+  if (package_nodes_.open(dir + "/packages.dat", mode) != kLoadSuccess) return false;
+  if (version_nodes_.open(dir + "/versions.dat", mode) != kLoadSuccess) return false;
+  if (dependency_edges_.open(dir + "/dependencies.dat", mode) != kLoadSuccess) return false;
+  if (version_lists_.open(dir + "/version-lists.dat", mode) != kLoadSuccess) return false;
+  if (string_pool_.open(dir + "/string-pool.dat", mode) != kLoadSuccess) return false;
+  if (string_pool_.compressed() != bool(control().flags & kCompressedStringsFlag)) return false;
+  if (version_packages_.open(dir + "/version-packages.dat", derived_mode) == kOpenFailed) return false;
+  if (journal_.open(dir + "/journal.dat", derived_mode) == kOpenFailed) return false;
+  if (repositories_.open(dir + "/repositories.dat", derived_mode) == kOpenFailed) return false;
+  if (repository_versions_.open(dir + "/repository-versions.dat", derived_mode) == kOpenFailed) return false;
+  if (tombstone_log_.open(dir + "/tombstones.dat", derived_mode) == kOpenFailed) return false;
+  auto tombstones_code = tombstones_.open(dir + "/tombstones.idx", derived_mode);
+  if (tombstones_code == kOpenFailed) return false;
+  if (sources_.open(dir + "/sources.dat", derived_mode) == kOpenFailed) return false;
+  if (stanza_index_.open(dir + "/stanzas.idx", derived_mode) == kOpenFailed && !read_only) return false;
   if (!validate_control()) return false;
+  auto checksum_code = checksums_.open(dir + "/checksums.dat", derived_mode);
+  if (checksum_code == kOpenFailed && !read_only) return false;
+  bool checksums_stale = checksum_code == kCreateSuccess;
+  for (auto bytes : checksum_sections(control()))
+    if (checksums_.is_open() && checksums_.size() * kChecksumBlockBytes < bytes.size()) checksums_stale = true;
+  if (read_only && checksums_stale) checksums_.close();
+  if (!read_only) recover();
+  if (tombstones_code == kCreateSuccess && !tombstone_log_.empty()) rebuild_tombstones();
+  if (tombstones_.size() * 64 < version_count()) {
+    if (read_only) return false;
+    tombstones_.resize((version_count() + 63) / 64);
+  }
+  logged_tombstones_.store(tombstone_log_.size(), std::memory_order_release);
+  if (version_packages_.size() < version_count()) {
+    if (read_only) return false;
+    rebuild_version_packages();
+    checksums_stale = true;
+  }
+  if (!read_only && checksums_stale) {
+    update_checksums(Control{}, control());
+    checksums_.sync(kSyncFull);
+  }
+  auto index_code = string_index_.open(dir + "/string-pool.idx", derived_mode);
+  if (index_code == kOpenFailed) return false;
+  string_index_stale_ = index_code == kCreateSuccess && string_pool_.size() > 0;
+  if (name_index_.open(dir + "/packages.idx", derived_mode) == kOpenFailed) return false;
+  if (version_index_.open(dir + "/versions.idx", derived_mode) == kOpenFailed) return false;
+  if (name_index_.size() < package_count() || version_index_.size() < version_count()) {
+    if (read_only) return false;
+    if (name_index_.size() < package_count()) rebuild_name_index();
+    if (version_index_.size() < version_count()) rebuild_version_index();
+  }
+  if (!read_only) {
+    string_index_.shrink_to_fit();
+    name_index_.shrink_to_fit();
+    version_index_.shrink_to_fit();
+    stanza_index_.shrink_to_fit();
+  }
+  rebuild_source_index();
+  directory_ = directory_path;
+  dirty_ = false;
+  return true;
+}
 
-  for (PackageId pid = 0; pid < package_count(); ++pid) {
-    const auto &pnode = package_nodes_[pid];
-    string_handle handle{
-      .offset = pnode.name_offset,
-      .length = pnode.name_length
-    };
-    name_to_package_id_.emplace(handle, pid);
+bool DiskGraph::load_packed(const std::filesystem::path &file_path) noexcept {
+  std::error_code error;
+  packed_.map(file_path.string(), error);
+  if (error || packed_.size() < sizeof(PackedHeader) + kPackedSectionCount * sizeof(PackedSection)) return false;
+  const auto &header = *reinterpret_cast<const PackedHeader *>(packed_.data());
+  if (header.magic != kPackedMagic || header.version != kPackedVersion || header.section_count != kPackedSectionCount
+    || !std::has_single_bit(header.alignment))
+    return false;
+  const auto *sections = reinterpret_cast<const PackedSection *>(packed_.data() + sizeof(PackedHeader));
+  for (std::size_t kind = 0; kind < kPackedSectionCount; ++kind) {
+    const auto &section = sections[kind];
+    if (section.kind != kind || section.offset % header.alignment != 0 || section.offset > packed_.size()
+      || section.length > packed_.size() - section.offset)
+      return false;
   }
+  auto attach = [this, sections](auto &file, PackedSectionKind kind) {
+    return file.attach(packed_.data() + sections[kind].offset, sections[kind].length);
+  };
+  if (!attach(control_, kPackedControl) || control_.size() < kControlSlotCount * control_size()) return false;
+  if (!select_control()) return false;
+  if (!attach(architectures_, kPackedArchitectures) || !attach(dependency_types_, kPackedDependencyTypes)) return false;
+  if (!attach(package_nodes_, kPackedPackages) || !attach(version_nodes_, kPackedVersions)) return false;
+  if (!attach(dependency_edges_, kPackedDependencies) || !attach(version_lists_, kPackedVersionLists)) return false;
+  if (!attach(version_packages_, kPackedVersionPackages) || !attach(journal_, kPackedJournal)) return false;
+  if (!attach(string_pool_, kPackedStringPool)) return false;
+  if (string_pool_.compressed() != bool(control().flags & kCompressedStringsFlag)) return false;
+  if (!attach(name_index_, kPackedNameIndex) || !attach(version_index_, kPackedVersionIndex)) return false;
+  if (!attach(repositories_, kPackedRepositories) || !attach(repository_versions_, kPackedRepositoryVersions))
+    return false;
+  if (!attach(tombstone_log_, kPackedTombstoneLog) || !attach(tombstones_, kPackedTombstones)) return false;
+  if (tombstones_.size() * 64 < version_count()) return false;
+  logged_tombstones_.store(tombstone_log_.size(), std::memory_order_release);
+  if (!attach(sources_, kPackedSources)) return false;
+  if (!validate_control() || has_uncommitted_tail()) return false;
+  rebuild_source_index();
+  string_index_stale_ = false;
+  dirty_ = false;
   return true;
 }
 
+void DiskGraph::export_packed(const std::filesystem::path &file_path, std::size_t alignment) const {
+  if (!is_open()) throw std::system_error(std::make_error_code(std::errc::bad_file_descriptor));
+  alignment = std::bit_ceil(std::max(alignment, mio::page_size()));
+  auto committed = snapshot();
+  const auto &control = committed.control_;
+  // Heads may already point at lists appended after the last commit, so export the heads the snapshot sees.
+  std::vector<PackageNode> packages(package_nodes_.begin(), package_nodes_.begin() + control.package_count);
+  for (PackageId pid = 0; pid < packages.size(); ++pid)
+    packages[pid].version_list_id = version_list_head(pid, committed);
+  std::array<Control, kControlSlotCount> controls{control};
+
+  auto temp_path = file_path;
+  temp_path += ".tmp";
+  std::ofstream os(temp_path, std::ios::binary | std::ios::trunc);
+  PackedHeader header{
+    .magic = kPackedMagic,
+    .version = kPackedVersion,
+    .alignment = alignment,
+    .section_count = kPackedSectionCount
+  };
+  std::array<PackedSection, kPackedSectionCount> sections{};
+  os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  os.write(reinterpret_cast<const char *>(sections.data()), sizeof(sections));
+  auto section = [&](PackedSectionKind kind, auto &&write) {
+    std::size_t offset = os.tellp();
+    auto aligned = (offset + alignment - 1) / alignment * alignment;
+    os.seekp(aligned);
+    write();
+    sections[kind] = {.kind = kind, .offset = aligned, .length = static_cast<std::size_t>(os.tellp()) - aligned};
+  };
+  section(kPackedControl, [&] {
+    decltype(control_)::write_image(os, reinterpret_cast<const std::byte *>(controls.data()), sizeof(controls));
+  });
+  section(kPackedArchitectures, [&] { architectures_.write_image(os, control.architecture_count); });
+  section(kPackedDependencyTypes, [&] { dependency_types_.write_image(os, control.dependency_type_count); });
+  section(kPackedPackages, [&] { decltype(package_nodes_)::write_image(os, packages.data(), packages.size()); });
+  section(kPackedVersions, [&] { version_nodes_.write_image(os, version_nodes_.data(), control.version_count); });
+  section(kPackedDependencies, [&] {
+    dependency_edges_.write_image(os, dependency_edges_.data(), control.dependency_count);
+  });
+  section(kPackedVersionLists, [&] {
+    version_lists_.write_image(os, version_lists_.data(), control.version_list_count);
+  });
+  section(kPackedVersionPackages, [&] {
+    version_packages_.write_image(os, version_packages_.data(), control.version_count);
+  });
+  section(kPackedJournal, [&] { journal_.write_image(os, nullptr, 0); });
+  section(kPackedStringPool, [&] { string_pool_.write_image(os, control.string_pool_size); });
+  section(kPackedNameIndex, [&] { name_index_.write_image(os); });
+  section(kPackedVersionIndex, [&] { version_index_.write_image(os); });
+  section(kPackedRepositories, [&] { repositories_.write_image(os, nullptr, 0); });
+  section(kPackedRepositoryVersions, [&] { repository_versions_.write_image(os, nullptr, 0); });
+  section(kPackedTombstoneLog, [&] {
+    tombstone_log_.write_image(os, tombstone_log_.data(), committed_size(tombstone_log_, control.sequence));
+  });
+  section(kPackedTombstones, [&] { tombstones_.write_image(os, tombstones_.data(), tombstones_.size()); });
+  section(kPackedSources, [&] { sources_.write_image(os, nullptr, 0); });
+  os.seekp(sizeof(header));
+  os.write(reinterpret_cast<const char *>(sections.data()), sizeof(sections));
+  os.close();
+  if (!os) throw std::system_error(std::make_error_code(std::errc::io_error));
+  std::filesystem::rename(temp_path, file_path);
+}
+
+void DiskGraph::compact() {
+  if (!is_open() || packed()) throw std::system_error(std::make_error_code(std::errc::bad_file_descriptor));
+  if (read_only()) throw std::system_error(std::make_error_code(std::errc::read_only_file_system));
+  commit();
+  // Old ids and mappings go away with the swap, so every snapshot pinned before this call must be released.
+  epoch_domain::global().synchronize();
+  auto directory = directory_;
+  auto staging = staging_path(directory);
+  auto retired = retired_path(directory);
+  std::filesystem::remove_all(staging);
+  {
+    DiskGraph compacted(chunk_bytes());
+    compacted.set_compressed_strings(compressed_strings());
+    compacted.set_background_verify(false);
+    compacted.set_ingest_threads(ingest_threads_);
+    compacted.set_durability(kSyncNone);
+    if (compacted.open(staging, kCreate) != kCreateSuccess)
+      throw std::system_error(std::make_error_code(std::errc::io_error));
+    for (auto arch : architectures_) compacted.add_architecture(arch);
+    for (auto dtype : dependency_types_) compacted.add_dependency_type(dtype);
+
+    // Live versions are replayed package by package in list order, so each package keeps its query order.
+    std::vector<VersionId> remap(version_count(), kInvalidVersionId);
+    std::vector<VersionId> batch;
+    BufferGraph bgraph;
+    auto flush = [&] {
+      std::vector<VersionId> version_ids(bgraph.version_count());
+      compacted.ingest(bgraph, version_ids);
+      for (std::size_t bvid = 0; bvid < batch.size(); ++bvid) remap[batch[bvid]] = version_ids[bvid];
+      bgraph.clear();
+      batch.clear();
+    };
+    std::string buffer;
+    for (PackageId pid = 0; pid < package_count(); ++pid) {
+      std::optional<PackageId> bpid;
+      for (auto vlid = package_nodes_[pid].version_list_id; vlid != kVersionListEndId;) {
+        const auto &vlnode = version_lists_[vlid];
+        for (auto vid = vlnode.version_id_begin; vid < vlnode.version_id_begin + vlnode.version_count; ++vid) {
+          if (tombstoned(vid)) continue;
+          const auto &pnode = package_nodes_[pid];
+          if (!bpid)
+            bpid = bgraph.create_package(string_pool_.get({pnode.name_offset, pnode.name_length}, buffer)).first;
+          const auto &vnode = version_nodes_[vid];
+          auto bvid = bgraph.create_version(
+            *bpid, string_pool_.get({vnode.version_offset, vnode.version_length}, buffer), vnode.architecture).first;
+          batch.push_back(vid);
+          for (auto did = vnode.dependency_id_begin; did < vnode.dependency_id_begin + vnode.dependency_count; ++did) {
+            const auto &dedge = dependency_edges_[did];
+            const auto &tpnode = package_nodes_[dedge.to_package_id];
+            auto tname = string_pool_.get({tpnode.name_offset, tpnode.name_length}, buffer);
+            auto tbpid = bgraph.create_package(tname).first;
+            auto vcons = string_pool_.get({dedge.version_constraint_offset, dedge.version_constraint_length}, buffer);
+            bgraph.create_dependency(bvid, tbpid, vcons, dedge.architecture_constraint, dedge.dependency_type,
+                                     dedge.group);
+          }
+        }
+        vlid = vlnode.next_version_list_id;
+      }
+      if (bgraph.dependency_count() >= kCompactionBatchDependencies) flush();
+    }
+    flush();
+
+    for (auto index : current_repositories()) {
+      const auto &entry = repositories_[index];
+      std::vector<VersionId> version_ids;
+      version_ids.reserve(entry.version_count);
+      for (std::size_t i = entry.version_begin; i < entry.version_begin + entry.version_count; ++i)
+        if (remap[repository_versions_[i]] != kInvalidVersionId) version_ids.push_back(remap[repository_versions_[i]]);
+      std::ranges::sort(version_ids);
+      RepositoryEntry compacted_entry{
+        .sequence = compacted.control().sequence + 1,
+        .name_hash = entry.name_hash,
+        .version_begin = compacted.repository_versions_.size(),
+        .version_count = version_ids.size()
+      };
+      compacted.repository_versions_.append(version_ids.begin(), version_ids.end());
+      compacted.repositories_.push_back(compacted_entry);
+    }
+    // Compaction drops every tombstone, so sources still current against the log restart from zero. Repository
+    // sources stay valid regardless, since their versions are live while the repository lists them.
+    std::unordered_set<std::uint64_t> repository_names;
+    for (auto index : current_repositories()) repository_names.insert(repositories_[index].name_hash);
+    for (auto [path_hash, index] : source_index_) {
+      auto source = sources_[index].source;
+      if (source.tombstone_count != tombstone_count() && !(source.repository && repository_names.contains(path_hash)))
+        continue;
+      source.tombstone_count = 0;
+      compacted.sources_.push_back({.sequence = compacted.control().sequence + 1, .source = source});
+    }
+    compacted.commit(kSyncFull);
+  }
+  close();
+  std::filesystem::remove_all(retired);
+  std::filesystem::rename(directory, retired);
+  std::filesystem::rename(staging, directory);
+  std::filesystem::remove_all(retired);
+  if (open(directory, kLoad) != kLoadSuccess) throw std::system_error(std::make_error_code(std::errc::io_error));
+}
+
 bool DiskGraph::create(const std::filesystem::path &directory_path,
                        std::initializer_list<std::string_view> architectures,
                        std::initializer_list<std::string_view> dependency_types) noexcept {
@@ -61,7 +631,7 @@ bool DiskGraph::create(const std::filesystem::path &directory_path,
   using enum open_code;
   std::string dir = directory_path.string();
   if (control_.open(dir + "/.meta", kCreate) != kCreateSuccess) return false;
-  control_.resize(control_size());
+  control_.resize(kControlSlotCount * control_size());
   if (architectures_.open(dir + "/architectures.dat", kCreate, architectures) != kCreateSuccess) return false;
   if (dependency_types_.open(dir + "/dependency-types.dat", kCreate, dependency_types) != kCreateSuccess) return false;
   if (package_nodes_.open(dir + "/packages.dat", kCreate) != kCreateSuccess) return false;
@@ -69,15 +639,28 @@ bool DiskGraph::create(const std::filesystem::path &directory_path,
   if (dependency_edges_.open(dir + "/dependencies.dat", kCreate) != kCreateSuccess) return false;
   if (version_lists_.open(dir + "/version-lists.dat", kCreate) != kCreateSuccess) return false;
   if (string_pool_.open(dir + "/string-pool.dat", kCreate) != kCreateSuccess) return false;
+  string_pool_.set_compressed(compressed_strings_);
+  if (version_packages_.open(dir + "/version-packages.dat", kCreate) != kCreateSuccess) return false;
+  if (journal_.open(dir + "/journal.dat", kCreate) != kCreateSuccess) return false;
+  if (string_index_.open(dir + "/string-pool.idx", kCreate) != kCreateSuccess) return false;
+  if (name_index_.open(dir + "/packages.idx", kCreate) != kCreateSuccess) return false;
+  if (version_index_.open(dir + "/versions.idx", kCreate) != kCreateSuccess) return false;
+  if (checksums_.open(dir + "/checksums.dat", kCreate) != kCreateSuccess) return false;
+  if (repositories_.open(dir + "/repositories.dat", kCreate) != kCreateSuccess) return false;
+  if (repository_versions_.open(dir + "/repository-versions.dat", kCreate) != kCreateSuccess) return false;
+  if (tombstone_log_.open(dir + "/tombstones.dat", kCreate) != kCreateSuccess) return false;
+  if (tombstones_.open(dir + "/tombstones.idx", kCreate) != kCreateSuccess) return false;
+  if (sources_.open(dir + "/sources.dat", kCreate) != kCreateSuccess) return false;
+  if (stanza_index_.open(dir + "/stanzas.idx", kCreate) != kCreateSuccess) return false;
+  source_index_.clear();
+  directory_ = directory_path;
+  string_index_stale_ = false;
 
-  control().magic = kMagicNumber;
-  control().architecture_count = architecture_count();
-  control().dependency_type_count = dependency_type_count();
-  control().package_count = 0;
-  control().version_count = 0;
-  control().dependency_count = 0;
-  control().version_list_count = 0;
-  control().string_pool_size = 0;
+  active_control_ = 0;
+  mutable_control_slot(0).magic = kMagicNumber;
+  mutable_control_slot(0).flags = kInternedStringsFlag | (compressed_strings_ ? kCompressedStringsFlag : 0);
+  write_control();
+  dirty_ = false;
   return true;
 }
 
@@ -86,8 +669,11 @@ open_code DiskGraph::open(const std::filesystem::path &directory_path, open_mode
                           std::initializer_list<std::string_view> dependency_types) noexcept {
   using enum open_mode;
   using enum open_code;
-  if (mode == kLoad) {
-    if (load(directory_path)) return kLoadSuccess;
+  if (mode == kLoad || mode == kReadOnly) {
+    if (load(directory_path, mode == kReadOnly)) {
+      start_verifier();
+      return kLoadSuccess;
+    }
     close();
     return kOpenFailed;
   }
@@ -97,7 +683,10 @@ open_code DiskGraph::open(const std::filesystem::path &directory_path, open_mode
     return kOpenFailed;
   }
   if (mode == kLoadOrCreate) {
-    if (load(directory_path)) return kLoadSuccess;
+    if (load(directory_path, false)) {
+      start_verifier();
+      return kLoadSuccess;
+    }
     if (create(directory_path, architectures, dependency_types)) return kCreateSuccess;
     close();
     return kOpenFailed;
@@ -106,6 +695,8 @@ open_code DiskGraph::open(const std::filesystem::path &directory_path, open_mode
 }
 
 void DiskGraph::close() {
+  verifier_ = {};
+  if (is_open() && dirty_) commit();
   control_.close();
   architectures_.close();
   dependency_types_.close();
@@ -113,19 +704,98 @@ void DiskGraph::close() {
   version_nodes_.close();
   dependency_edges_.close();
   version_lists_.close();
+  version_packages_.close();
+  journal_.close();
   string_pool_.close();
-  name_to_package_id_.clear();
+  string_index_.close();
+  name_index_.close();
+  version_index_.close();
+  checksums_.close();
+  repositories_.close();
+  repository_versions_.close();
+  tombstone_log_.close();
+  tombstones_.close();
+  logged_tombstones_.store(0, std::memory_order_release);
+  sources_.close();
+  source_index_.clear();
+  stanza_index_.close();
+  packed_.unmap();
+  directory_.clear();
+  verify_report_ = {};
 }
 
-void DiskGraph::sync() {
-  control_.sync();
-  architectures_.sync();
-  dependency_types_.sync();
-  package_nodes_.sync();
-  version_nodes_.sync();
-  dependency_edges_.sync();
-  version_lists_.sync();
-  string_pool_.sync();
+void DiskGraph::commit(durability_mode mode) {
+  if (!is_open() || read_only()) return;
+  std::unique_lock lock(checksum_mutex_);
+  update_checksums(control(), current_control());
+  if (mode == kSyncFull) {
+    std::vector<std::future<void>> pending;
+    auto sync_async = [&pending](auto &file) {
+      pending.emplace_back(std::async(std::launch::async, [&file] { file.sync(kSyncFull); }));
+    };
+    sync_async(architectures_);
+    sync_async(dependency_types_);
+    sync_async(package_nodes_);
+    sync_async(version_nodes_);
+    sync_async(dependency_edges_);
+    sync_async(version_lists_);
+    sync_async(version_packages_);
+    sync_async(string_pool_);
+    sync_async(string_index_);
+    sync_async(name_index_);
+    sync_async(version_index_);
+    sync_async(checksums_);
+    sync_async(repositories_);
+    sync_async(repository_versions_);
+    sync_async(tombstone_log_);
+    sync_async(tombstones_);
+    sync_async(sources_);
+    sync_async(stanza_index_);
+    for (auto &future : pending) future.get();
+  } else {
+    // kSyncNone still copies resident writes back to the mappings.
+    architectures_.sync(mode);
+    dependency_types_.sync(mode);
+    package_nodes_.sync(mode);
+    version_nodes_.sync(mode);
+    dependency_edges_.sync(mode);
+    version_lists_.sync(mode);
+    version_packages_.sync(mode);
+    string_pool_.sync(mode);
+    string_index_.sync(mode);
+    name_index_.sync(mode);
+    version_index_.sync(mode);
+    checksums_.sync(mode);
+    repositories_.sync(mode);
+    repository_versions_.sync(mode);
+    tombstone_log_.sync(mode);
+    tombstones_.sync(mode);
+    sources_.sync(mode);
+    stanza_index_.sync(mode);
+  }
+  write_control();
+  control_.sync(mode);
+  journal_.clear();
+  lock.unlock();
+  dirty_ = false;
+  epoch_domain::global().collect();
+}
+
+DiskGraph::Snapshot DiskGraph::snapshot() const {
+  Snapshot snapshot;
+  snapshot.guard_ = epoch_domain::global().pin();
+  // The writer only overwrites the inactive slot, so a copy that still matches the active slot afterwards and
+  // carries a valid checksum was not torn.
+  auto *words = reinterpret_cast<std::size_t *>(&snapshot.control_);
+  for (;;) {
+    auto slot = active_control_.load(std::memory_order_acquire);
+    auto *source = reinterpret_cast<std::size_t *>(const_cast<Control *>(&control_slot(slot)));
+    for (std::size_t i = 0; i < control_size() / sizeof(std::size_t); ++i)
+      words[i] = std::atomic_ref(source[i]).load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (active_control_.load(std::memory_order_relaxed) == slot && valid_control(snapshot.control_)) break;
+  }
+  return snapshot;
 }
 
 void DiskGraph::set_chunk_bytes(std::size_t chunk_bytes) noexcept {
@@ -133,45 +803,165 @@ void DiskGraph::set_chunk_bytes(std::size_t chunk_bytes) noexcept {
   version_nodes_.set_chunk_bytes(chunk_bytes);
   dependency_edges_.set_chunk_bytes(chunk_bytes);
   version_lists_.set_chunk_bytes(chunk_bytes);
+  version_packages_.set_chunk_bytes(chunk_bytes);
   string_pool_.set_chunk_bytes(chunk_bytes);
+  string_index_.set_chunk_bytes(chunk_bytes);
+  name_index_.set_chunk_bytes(chunk_bytes);
+  version_index_.set_chunk_bytes(chunk_bytes);
 }
 
-ArchitectureType DiskGraph::add_architecture(std::string_view arch) noexcept {
+void DiskGraph::set_growth_factor(double growth_factor) noexcept {
+  package_nodes_.set_growth_factor(growth_factor);
+  version_nodes_.set_growth_factor(growth_factor);
+  dependency_edges_.set_growth_factor(growth_factor);
+  version_lists_.set_growth_factor(growth_factor);
+  version_packages_.set_growth_factor(growth_factor);
+  string_pool_.set_growth_factor(growth_factor);
+  string_index_.set_growth_factor(growth_factor);
+  name_index_.set_growth_factor(growth_factor);
+  version_index_.set_growth_factor(growth_factor);
+}
+
+void DiskGraph::set_durability(durability_mode durability) noexcept {
+  durability_ = durability;
+  control_.set_durability(durability);
+  architectures_.set_durability(durability);
+  dependency_types_.set_durability(durability);
+  package_nodes_.set_durability(durability);
+  version_nodes_.set_durability(durability);
+  dependency_edges_.set_durability(durability);
+  version_lists_.set_durability(durability);
+  version_packages_.set_durability(durability);
+  journal_.set_durability(durability);
+  string_pool_.set_durability(durability);
+  string_index_.set_durability(durability);
+  name_index_.set_durability(durability);
+  version_index_.set_durability(durability);
+  checksums_.set_durability(durability);
+  repositories_.set_durability(durability);
+  repository_versions_.set_durability(durability);
+  tombstone_log_.set_durability(durability);
+  tombstones_.set_durability(durability);
+  sources_.set_durability(durability);
+  stanza_index_.set_durability(durability);
+}
+
+void DiskGraph::set_populate(bool populate) noexcept {
+  package_nodes_.set_populate(populate);
+  version_nodes_.set_populate(populate);
+  dependency_edges_.set_populate(populate);
+  version_lists_.set_populate(populate);
+  version_packages_.set_populate(populate);
+  string_pool_.set_populate(populate);
+  string_index_.set_populate(populate);
+  name_index_.set_populate(populate);
+  version_index_.set_populate(populate);
+  tombstones_.set_populate(populate);
+}
+
+void DiskGraph::set_memory_resident(bool resident) noexcept {
+  package_nodes_.set_resident(resident);
+  version_nodes_.set_resident(resident);
+  dependency_edges_.set_resident(resident);
+  version_lists_.set_resident(resident);
+  version_packages_.set_resident(resident);
+  string_pool_.set_resident(resident);
+  string_index_.set_resident(resident);
+  name_index_.set_resident(resident);
+  version_index_.set_resident(resident);
+  tombstones_.set_resident(resident);
+}
+
+std::size_t DiskGraph::warmup(std::size_t budget_bytes) {
+  if (!is_open()) return 0;
+  std::vector<std::future<std::size_t>> pending;
+  auto prefetch = [&pending, &budget_bytes](auto &file) {
+    auto bytes = std::min(budget_bytes, file.size_bytes());
+    if (bytes == 0) return;
+    budget_bytes -= bytes;
+    pending.emplace_back(std::async(std::launch::async, [&file, bytes] { return file.prefetch(bytes); }));
+  };
+  prefetch(name_index_);
+  prefetch(package_nodes_);
+  prefetch(version_lists_);
+  prefetch(version_index_);
+  prefetch(version_packages_);
+  prefetch(version_nodes_);
+  prefetch(dependency_edges_);
+  prefetch(string_pool_);
+  std::size_t prefetched = 0;
+  for (auto &future : pending) prefetched += future.get();
+  return prefetched;
+}
+
+double DiskGraph::resident_fraction() const noexcept {
+  std::size_t resident = 0, total = 0;
+  auto count = [&resident, &total](const auto &file) {
+    resident += file.resident_bytes();
+    total += file.size_bytes();
+  };
+  count(package_nodes_);
+  count(version_nodes_);
+  count(dependency_edges_);
+  count(version_lists_);
+  count(version_packages_);
+  count(string_pool_);
+  count(string_index_);
+  count(name_index_);
+  count(version_index_);
+  return total ? static_cast<double>(resident) / total : 0.0;
+}
+
+ArchitectureType DiskGraph::add_architecture(std::string_view arch) {
   auto atype = architectures_.add(arch);
-  control().architecture_count = architecture_count();
+  dirty_ = true;
   return atype;
 }
 
-DependencyType DiskGraph::add_dependency_type(std::string_view dtype) noexcept {
+DependencyType DiskGraph::add_dependency_type(std::string_view dtype) {
   auto dtyp = dependency_types_.add(dtype);
-  control().dependency_type_count = dependency_type_count();
+  dirty_ = true;
   return dtyp;
 }
 
+std::string_view DiskGraph::view_string(string_handle_offset_t offset, string_handle_length_t length,
+                                       std::shared_ptr<const std::string> &storage) const {
+  if (!string_pool_.compressed()) return string_pool_.get(offset, length);
+  auto decoded = std::make_shared<std::string>();
+  string_pool_.get({.offset = offset, .length = length}, *decoded);
+  storage = std::move(decoded);
+  return *storage;
+}
+
 PackageView DiskGraph::get_package(PackageId pid) const noexcept {
   const auto &pnode = package_nodes_[pid];
+  std::shared_ptr<const std::string> storage;
+  auto name = view_string(pnode.name_offset, pnode.name_length, storage);
   return {
     .id = pid,
-    .name = string_pool_.get(pnode.name_offset, pnode.name_length),
+    .name = name,
     .versions = [this, pid] {
       std::vector<VersionView> vviews;
       const auto &pnode = package_nodes_[pid];
       for (auto vlid = pnode.version_list_id; vlid != kVersionListEndId;) {
         const auto &vlnode = version_lists_[vlid];
         for (auto vid = vlnode.version_id_begin; vid < vlnode.version_id_begin + vlnode.version_count; ++vid)
-          vviews.emplace_back(get_version(vid));
+          if (!tombstoned(vid)) vviews.emplace_back(get_version(vid));
         vlid = vlnode.next_version_list_id;
       }
       return vviews;
-    }
+    },
+    .storage = std::move(storage),
   };
 }
 
 VersionView DiskGraph::get_version(VersionId vid) const noexcept {
   const auto &vnode = version_nodes_[vid];
+  std::shared_ptr<const std::string> storage;
+  auto version = view_string(vnode.version_offset, vnode.version_length, storage);
   return {
     .id = vid,
-    .version = string_pool_.get(vnode.version_offset, vnode.version_length),
+    .version = version,
     .architecture = architectures_.get(vnode.architecture),
     .dependencies = [this, vid] {
       std::vector<DependencyView> dviews;
@@ -179,129 +969,507 @@ VersionView DiskGraph::get_version(VersionId vid) const noexcept {
       for (auto did = vnode.dependency_id_begin; did < vnode.dependency_id_begin + vnode.dependency_count; ++did)
         dviews.emplace_back(get_dependency(did));
       return dviews;
-    }
+    },
+    .storage = std::move(storage),
   };
 }
 
 DependencyView DiskGraph::get_dependency(DependencyId did) const noexcept {
   const auto &dedge = dependency_edges_[did];
+  std::shared_ptr<const std::string> storage;
+  auto version_constraint = view_string(dedge.version_constraint_offset, dedge.version_constraint_length, storage);
   return {
     .id = did,
     .from_version = [this, did] { return get_version(dependency_edges_[did].from_version_id); },
     .to_package = [this, did] { return get_package(dependency_edges_[did].to_package_id); },
     .dependency_type = dependency_types_.get(dedge.dependency_type),
-    .version_constraint = string_pool_.get(dedge.version_constraint_offset, dedge.version_constraint_length),
+    .version_constraint = version_constraint,
     .architecture_constraint = architectures_.get(dedge.architecture_constraint),
     .group = dedge.group,
+    .storage = std::move(storage),
   };
 }
 
 std::optional<PackageView> DiskGraph::get_package(std::string_view name) const noexcept {
-  auto it = name_to_package_id_.find(name);
-  if (it != name_to_package_id_.end()) return get_package(it->second);
+  if (auto pid = find_package(name, stable_hash(name))) return get_package(*pid);
   return std::nullopt;
 }
 
-std::pair<PackageId, bool> DiskGraph::create_package(std::string_view name) {
-  auto it = name_to_package_id_.find(name);
-  if (it != name_to_package_id_.end()) return {it->second, false};
-  PackageId pid = package_count();
-  auto handle = string_pool_.add(name);
-  control().string_pool_size = string_pool_.size();
+std::optional<PackageId> DiskGraph::find_package(std::string_view name, std::uint64_t hash,
+                                                 std::size_t package_limit) const {
+  return name_index_.find(hash, [this, name, package_limit](PackageId pid) {
+    if (pid >= package_limit) return false;
+    const auto &pnode = package_nodes_[pid];
+    return string_pool_.equal(pnode.name_offset, pnode.name_length, name);
+  });
+}
+
+void DiskGraph::rebuild_name_index() {
+  name_index_.clear();
+  name_index_.reserve(package_count());
+  string_pool_.set_advice(kAdviceSequential);
+  std::string buffer;
+  for (PackageId pid = 0; pid < package_count(); ++pid) {
+    const auto &pnode = package_nodes_[pid];
+    name_index_.insert(stable_hash(string_pool_.get({pnode.name_offset, pnode.name_length}, buffer)), pid);
+  }
+  string_pool_.set_advice(kAdviceNormal);
+}
 
-  package_nodes_.push_back({
-    .name_offset = handle.offset,
-    .name_length = handle.length,
-    .version_list_id = kVersionListEndId
+std::uint64_t DiskGraph::version_hash(PackageId pid, std::uint64_t version_hash, ArchitectureType arch) noexcept {
+  return stable_hash_combine(stable_hash_combine(version_hash, pid), arch);
+}
+
+std::optional<VersionId> DiskGraph::find_version(PackageId pid, std::string_view version, ArchitectureType arch,
+                                                 const Snapshot &snapshot) const {
+  return find_version(pid, version, arch, snapshot.version_count(), snapshot.sequence());
+}
+
+std::optional<VersionId> DiskGraph::find_version(PackageId pid, std::string_view version, ArchitectureType arch,
+                                                 std::size_t version_limit, std::size_t sequence) const {
+  auto key = version_index_.find(version_hash(pid, version, arch), [=, this](VersionKey key) {
+    if (key.package_id != pid || key.version_id >= version_limit) return false;
+    if (version_packages_[key.version_id] != pid || tombstoned_at(key.version_id, sequence)) return false;
+    const auto &vnode = version_nodes_[key.version_id];
+    return vnode.architecture == arch && string_pool_.equal(vnode.version_offset, vnode.version_length, version);
   });
-  name_to_package_id_.emplace(handle, pid);
-  control().package_count++;
-  return {pid, true};
+  if (key) return key->version_id;
+  return std::nullopt;
 }
 
-std::pair<VersionId, bool> DiskGraph::create_version(PackageId pid, std::string_view version, ArchitectureType arch,
-                                                     DependencyId did_begin, DependencyCountType dcount) {
-  const auto &pnode = package_nodes_[pid];
-  for (auto vlid = pnode.version_list_id; vlid != kVersionListEndId;) {
-    const auto &vlnode = version_lists_[vlid];
-    for (auto vid = vlnode.version_id_begin; vid < vlnode.version_id_begin + vlnode.version_count; ++vid) {
-      const auto &vnode = version_nodes_[vid];
-      auto vstr = string_pool_.get(vnode.version_offset, vnode.version_length);
-      if (vstr == version && vnode.architecture == arch) return {vid, false};
+auto DiskGraph::version_list_head(PackageId pid, const Snapshot &snapshot) const noexcept -> VersionListId {
+  auto &head = const_cast<VersionListId &>(package_nodes_[pid].version_list_id);
+  auto vlid = std::atomic_ref(head).load(std::memory_order_acquire);
+  // Lists appended after the snapshot chain back to the head it saw.
+  while (vlid != kVersionListEndId && vlid >= snapshot.version_list_count())
+    vlid = version_lists_[vlid].next_version_list_id;
+  return vlid;
+}
+
+void DiskGraph::rebuild_version_index() {
+  version_index_.clear();
+  version_index_.reserve(version_count());
+  std::string buffer;
+  for (PackageId pid = 0; pid < package_count(); ++pid)
+    for (auto vlid = package_nodes_[pid].version_list_id; vlid != kVersionListEndId;) {
+      const auto &vlnode = version_lists_[vlid];
+      for (auto vid = vlnode.version_id_begin; vid < vlnode.version_id_begin + vlnode.version_count; ++vid) {
+        const auto &vnode = version_nodes_[vid];
+        auto version = string_pool_.get({vnode.version_offset, vnode.version_length}, buffer);
+        version_index_.insert(version_hash(pid, version, vnode.architecture), {.package_id = pid, .version_id = vid});
+      }
+      vlid = vlnode.next_version_list_id;
     }
-    vlid = vlnode.next_version_list_id;
-  }
+}
 
-  VersionId vid = version_count();
-  auto handle = string_pool_.add(version);
-  control().string_pool_size = string_pool_.size();
+void DiskGraph::rebuild_version_packages() {
+  version_packages_.resize(version_count());
+  for (PackageId pid = 0; pid < package_count(); ++pid)
+    for (auto vlid = package_nodes_[pid].version_list_id; vlid != kVersionListEndId;) {
+      const auto &vlnode = version_lists_[vlid];
+      for (auto vid = vlnode.version_id_begin; vid < vlnode.version_id_begin + vlnode.version_count; ++vid)
+        version_packages_[vid] = pid;
+      vlid = vlnode.next_version_list_id;
+    }
+}
 
-  version_nodes_.push_back({
-    .version_offset = handle.offset,
-    .version_length = handle.length,
-    .architecture = arch,
-    .dependency_count = dcount,
-    .dependency_id_begin = did_begin
+std::optional<string_handle> DiskGraph::find_string(std::string_view str, std::uint64_t hash) const {
+  return string_index_.find(hash, [this, str](string_handle handle) {
+    return handle.offset + (string_pool_.compressed() ? 0 : handle.length) <= string_pool_.size()
+      && string_pool_.equal(handle, str);
   });
-  control().version_count++;
-  return {vid, true};
-}
-
-std::pair<DependencyId, bool> DiskGraph::create_dependency(VersionId from_vid, PackageId to_pid, std::string_view vcons,
-                                                           ArchitectureType acons, DependencyType dtype, GroupId gid) {
-  DependencyId did = dependency_count();
-  auto handle = string_pool_.add(vcons);
-  control().string_pool_size = string_pool_.size();
-
-  dependency_edges_.push_back({
-    .from_version_id = from_vid,
-    .to_package_id = to_pid,
-    .version_constraint_offset = handle.offset,
-    .version_constraint_length = handle.length,
-    .architecture_constraint = acons,
-    .dependency_type = dtype,
-    .group = gid
+}
+
+string_handle DiskGraph::intern_string(std::string_view str, std::uint64_t hash) {
+  if (auto handle = find_string(str, hash)) return *handle;
+  auto handle = string_pool_.add(str);
+  string_index_.insert(hash, handle);
+  return handle;
+}
+
+void DiskGraph::rebuild_string_index() {
+  string_index_.clear();
+  std::string buffer;
+  auto index = [this, &buffer](string_handle_offset_t offset, string_handle_length_t length) {
+    string_handle handle{.offset = offset, .length = length};
+    auto str = string_pool_.get(handle, buffer);
+    auto hash = stable_hash(str);
+    if (!find_string(str, hash)) string_index_.insert(hash, handle);
+  };
+  string_pool_.set_advice(kAdviceSequential);
+  version_nodes_.set_advice(kAdviceSequential);
+  dependency_edges_.set_advice(kAdviceSequential);
+  for (const auto &pnode : std::as_const(package_nodes_)) index(pnode.name_offset, pnode.name_length);
+  for (const auto &vnode : std::as_const(version_nodes_)) index(vnode.version_offset, vnode.version_length);
+  for (const auto &dedge : std::as_const(dependency_edges_))
+    index(dedge.version_constraint_offset, dedge.version_constraint_length);
+  string_pool_.set_advice(kAdviceNormal);
+  version_nodes_.set_advice(kAdviceRandom);
+  dependency_edges_.set_advice(kAdviceRandom);
+  string_index_stale_ = false;
+}
+
+struct DiskGraph::IngestPartition {
+  PackageId bpid_begin = 0;
+  PackageId bpid_end = 0;
+  std::vector<std::pair<PackageId, std::uint64_t>> new_packages;
+  std::vector<string_handle> name_handles;
+  std::vector<VersionId> bvids;
+  std::vector<std::pair<PackageId, std::size_t>> attachments;
+  std::vector<std::uint64_t> string_hashes;
+  std::vector<std::optional<string_handle>> string_handles;
+  std::vector<std::pair<std::uint64_t, VersionId>> stanzas;
+  std::vector<VersionId> replaced;
+  std::size_t dependency_count = 0;
+  std::size_t string_bytes = 0;
+  VersionId vid_begin = 0;
+  DependencyId did_begin = 0;
+};
+
+void DiskGraph::ingest(const BufferGraph &bgraph, std::span<VersionId> version_ids) {
+  if (bgraph.package_count() == 0) return;
+  if (read_only()) throw std::system_error(std::make_error_code(std::errc::read_only_file_system));
+  dirty_ = true;
+  if (string_index_stale_) rebuild_string_index();
+
+  auto partition_count = std::min(std::max<std::size_t>(ingest_threads_, 1),
+                                  bgraph.version_count() / kMinIngestPartitionVersions + 1);
+  std::vector<IngestPartition> partitions;
+  partitions.reserve(partition_count);
+  std::size_t versions_per_partition = bgraph.version_count() / partition_count + 1;
+  for (PackageId bpid = 0, bpid_begin = 0, vcount = 0; bpid < bgraph.package_count(); ++bpid) {
+    vcount += bgraph.version_ids(bpid).size();
+    if (vcount < versions_per_partition && bpid + 1 < bgraph.package_count()) continue;
+    auto &partition = partitions.emplace_back();
+    partition.bpid_begin = bpid_begin;
+    partition.bpid_end = bpid + 1;
+    bpid_begin = bpid + 1;
+    vcount = 0;
+  }
+  auto parallel = [&partitions](auto &&fn) {
+    if (partitions.size() == 1) return fn(partitions.front());
+    std::vector<std::future<void>> pending;
+    for (auto &part : partitions) pending.emplace_back(std::async(std::launch::async, [&fn, &part] { fn(part); }));
+    for (auto &future : pending) future.get();
+  };
+
+  PackageId pid_begin = package_count();
+  std::vector<PackageId> pids(bgraph.package_count());
+  parallel([&](IngestPartition &part) {
+    for (auto bpid = part.bpid_begin; bpid < part.bpid_end; ++bpid) {
+      const auto &name = bgraph.get_package(bpid).name;
+      auto hash = stable_hash(name);
+      if (auto pid = find_package(name, hash)) pids[bpid] = *pid;
+      else part.new_packages.emplace_back(bpid, hash);
+    }
   });
-  control().dependency_count++;
-  return {did, true};
-}
-
-void DiskGraph::attach_versions(PackageId pid, VersionId vid_begin, VersionCountType vcount) {
-  if (vcount == 0) return;
-  auto &pnode = package_nodes_[pid];
-  VersionListId vlid = version_lists_.size();
-  version_lists_.push_back({
-    .version_count = vcount,
-    .version_id_begin = vid_begin,
-    .next_version_list_id = pnode.version_list_id
+  PackageId pid_end = pid_begin;
+  for (auto &part : partitions)
+    for (auto [bpid, hash] : part.new_packages) pids[bpid] = pid_end++;
+
+  parallel([&](IngestPartition &part) {
+    for (auto [bpid, hash] : part.new_packages) part.string_bytes += bgraph.get_package(bpid).name.size();
+    for (auto bpid = part.bpid_begin; bpid < part.bpid_end; ++bpid) {
+      auto pid = pids[bpid];
+      auto bvid_begin = part.bvids.size();
+      for (auto bvid : bgraph.version_ids(bpid)) {
+        const auto &bvnode = bgraph.get_version(bvid);
+        if (auto vid = pid < pid_begin ? find_version(pid, bvnode.version, bvnode.architecture) : std::nullopt) {
+          if (!bvnode.content_hash || same_dependencies(*vid, bgraph, bvid, pids)) {
+            if (!version_ids.empty()) version_ids[bvid] = *vid;
+            if (bvnode.content_hash) part.stanzas.emplace_back(bvnode.content_hash, *vid);
+            continue;
+          }
+          part.replaced.push_back(*vid);
+        }
+        part.bvids.push_back(bvid);
+        part.dependency_count += bvnode.dependency_count;
+        part.string_bytes += bvnode.version.size();
+        for (auto bdid : bgraph.dependency_ids(bvid))
+          part.string_bytes += bgraph.get_dependency(bdid).version_constraint.size();
+      }
+      if (part.bvids.size() > bvid_begin) part.attachments.emplace_back(pid, part.bvids.size() - bvid_begin);
+    }
   });
-  pnode.version_list_id = vlid;
-  control().version_list_count++;
-}
 
-void DiskGraph::ingest(const BufferGraph &bgraph) {
-  for (auto bpid = 0; bpid < bgraph.package_count(); ++bpid) {
-    const auto &bpnode = bgraph.get_package(bpid);
-    VersionId vid_begin = version_count();
-    VersionCountType vcount = 0;
-    auto [pid, psucc] = create_package(bpnode.name);
+  VersionId vid_end = version_count();
+  DependencyId did_end = dependency_count();
+  std::size_t string_bytes = 0;
+  for (auto &part : partitions) {
+    part.vid_begin = vid_end;
+    part.did_begin = did_end;
+    vid_end += part.bvids.size();
+    did_end += part.dependency_count;
+    string_bytes += part.string_bytes;
+  }
+
+  parallel([&](IngestPartition &part) {
+    part.string_hashes.reserve(part.bvids.size() + part.dependency_count);
+    part.string_handles.reserve(part.bvids.size() + part.dependency_count);
+    auto lookup = [this, &part](std::string_view str) {
+      auto hash = stable_hash(str);
+      part.string_hashes.push_back(hash);
+      part.string_handles.push_back(find_string(str, hash));
+    };
+    for (auto bvid : part.bvids) {
+      const auto &bvnode = bgraph.get_version(bvid);
+      lookup(bvnode.version);
+      for (auto bdid : bgraph.dependency_ids(bvid)) lookup(bgraph.get_dependency(bdid).version_constraint);
+    }
+  });
 
-    for (auto bvid : bpnode.version_ids) {
+  string_pool_.reserve(string_pool_.size() + string_bytes);
+  name_index_.reserve(pid_end);
+  version_index_.reserve(vid_end);
+  package_nodes_.resize(pid_end);
+  version_nodes_.resize(vid_end);
+  version_packages_.resize(vid_end);
+  tombstones_.resize((vid_end + 63) / 64);
+  dependency_edges_.resize(did_end);
+
+  for (auto &part : partitions) {
+    part.name_handles.reserve(part.new_packages.size());
+    for (auto [bpid, hash] : part.new_packages) {
+      part.name_handles.push_back(intern_string(bgraph.get_package(bpid).name, hash));
+      name_index_.insert(hash, pids[bpid]);
+    }
+  }
+  for (auto &part : partitions) {
+    auto hash = part.string_hashes.begin();
+    auto handle = part.string_handles.begin();
+    auto intern = [&](std::string_view str) {
+      if (!*handle) *handle = intern_string(str, *hash);
+      ++hash, ++handle;
+    };
+    VersionId vid = part.vid_begin;
+    for (auto bvid : part.bvids) {
       const auto &bvnode = bgraph.get_version(bvid);
-      DependencyId did_begin = dependency_count();
-      DependencyCountType dcount = bvnode.dependency_ids.size();
-      auto [vid, vsucc] = create_version(pid, bvnode.version, bvnode.architecture, did_begin, dcount);
-      if (!vsucc) continue;
-      vcount++;
+      auto pid = pids[bvnode.package_id];
+      version_index_.insert(version_hash(pid, *hash, bvnode.architecture), {.package_id = pid, .version_id = vid++});
+      intern(bvnode.version);
+      for (auto bdid : bgraph.dependency_ids(bvid)) intern(bgraph.get_dependency(bdid).version_constraint);
+    }
+  }
 
-      for (auto bdid : bvnode.dependency_ids) {
+  parallel([&](IngestPartition &part) {
+    for (std::size_t i = 0; i < part.new_packages.size(); ++i)
+      package_nodes_[pids[part.new_packages[i].first]] = {
+        .name_offset = part.name_handles[i].offset,
+        .name_length = part.name_handles[i].length,
+        .version_list_id = kVersionListEndId
+      };
+    auto handle = part.string_handles.begin();
+    VersionId vid = part.vid_begin;
+    DependencyId did = part.did_begin;
+    for (auto bvid : part.bvids) {
+      const auto &bvnode = bgraph.get_version(bvid);
+      auto vhandle = **handle++;
+      version_nodes_[vid] = {
+        .version_offset = vhandle.offset,
+        .version_length = vhandle.length,
+        .architecture = bvnode.architecture,
+        .dependency_count = static_cast<DependencyCountType>(bvnode.dependency_count),
+        .dependency_id_begin = did
+      };
+      version_packages_[vid] = pids[bvnode.package_id];
+      if (!version_ids.empty()) version_ids[bvid] = vid;
+      if (bvnode.content_hash) part.stanzas.emplace_back(bvnode.content_hash, vid);
+      for (auto bdid : bgraph.dependency_ids(bvid)) {
         const auto &bdedge = bgraph.get_dependency(bdid);
-        const auto &btpnode = bgraph.get_package(bdedge.to_package_id);
-        auto [tpid, tpsucc] = create_package(btpnode.name);
-        create_dependency(vid, tpid, bdedge.version_constraint, bdedge.architecture_constraint, bdedge.dependency_type,
-                          bdedge.group);
+        auto chandle = **handle++;
+        dependency_edges_[did++] = {
+          .from_version_id = vid,
+          .to_package_id = pids[bdedge.to_package_id],
+          .version_constraint_offset = chandle.offset,
+          .version_constraint_length = chandle.length,
+          .architecture_constraint = bdedge.architecture_constraint,
+          .dependency_type = bdedge.dependency_type,
+          .group = bdedge.group
+        };
       }
+      ++vid;
+    }
+  });
+
+  std::vector<std::pair<PackageId, std::size_t>> attachments;
+  for (const auto &part : partitions)
+    attachments.insert(attachments.end(), part.attachments.begin(), part.attachments.end());
+  attach_versions(partitions.front().vid_begin, attachments);
+  std::vector<VersionId> replaced;
+  for (const auto &part : partitions) replaced.insert(replaced.end(), part.replaced.begin(), part.replaced.end());
+  if (!replaced.empty()) tombstone(replaced);
+  // Stanzas are recorded only against versions appended above or whose dependencies matched.
+  for (const auto &part : partitions)
+    for (auto [hash, vid] : part.stanzas) {
+      auto recorded = stanza_index_.find(hash, [hash, vid](StanzaKey key) {
+        return key.content_hash == hash && key.version_id == vid;
+      });
+      if (!recorded) stanza_index_.insert(hash, {.content_hash = hash, .version_id = vid});
     }
-    attach_versions(pid, vid_begin, vcount);
+}
+
+bool DiskGraph::same_dependencies(VersionId vid, const BufferGraph &bgraph, VersionId bvid,
+                                  const std::vector<PackageId> &pids) const {
+  const auto &vnode = version_nodes_[vid];
+  auto bdids = bgraph.dependency_ids(bvid);
+  if (vnode.dependency_count != bdids.size()) return false;
+  auto did = vnode.dependency_id_begin;
+  return std::ranges::all_of(bdids, [&](auto bdid) {
+    const auto &dedge = dependency_edges_[did++];
+    const auto &bdedge = bgraph.get_dependency(bdid);
+    return dedge.to_package_id == pids[bdedge.to_package_id]
+      && dedge.architecture_constraint == bdedge.architecture_constraint
+      && dedge.dependency_type == bdedge.dependency_type && dedge.group == bdedge.group
+      && string_pool_.equal(dedge.version_constraint_offset, dedge.version_constraint_length,
+                            bdedge.version_constraint);
+  });
+}
+
+void DiskGraph::attach_versions(VersionId vid_begin,
+                                const std::vector<std::pair<PackageId, std::size_t>> &attachments) {
+  constexpr std::size_t kMaxListLength = std::numeric_limits<VersionCountType>::max();
+  std::vector<std::pair<PackageId, VersionListId>> heads;
+  heads.reserve(attachments.size());
+  version_lists_.reserve(version_lists_.size() + attachments.size());
+  std::lock_guard lock(checksum_mutex_);
+  auto vid = vid_begin;
+  for (auto [pid, vcount] : attachments) {
+    auto vlid = package_nodes_[pid].version_list_id;
+    if (pid < control().package_count)
+      journal_.push_back({.sequence = control().sequence + 1, .package_id = pid, .version_list_id = vlid});
+    while (vcount > 0) {
+      auto count = std::min(vcount, kMaxListLength);
+      version_lists_.push_back({
+        .version_count = static_cast<VersionCountType>(count),
+        .version_id_begin = vid,
+        .next_version_list_id = vlid
+      });
+      vlid = version_lists_.size() - 1;
+      vid += count;
+      vcount -= count;
+    }
+    heads.emplace_back(pid, vlid);
   }
+  if (!journal_.empty()) journal_.sync(durability_);
+  for (auto [pid, vlid] : heads)
+    std::atomic_ref(package_nodes_[pid].version_list_id).store(vlid, std::memory_order_release);
+}
+
+std::vector<std::size_t> DiskGraph::current_repositories() const {
+  std::vector<std::size_t> current;
+  std::unordered_set<std::uint64_t> seen;
+  for (auto index = visible_size(repositories_); index-- > 0;)
+    if (seen.insert(repositories_[index].name_hash).second) current.push_back(index);
+  return current;
+}
+
+void DiskGraph::replace_repository(std::string_view name, std::vector<VersionId> version_ids) {
+  if (read_only()) throw std::system_error(std::make_error_code(std::errc::read_only_file_system));
+  std::ranges::sort(version_ids);
+  version_ids.erase(std::unique(version_ids.begin(), version_ids.end()), version_ids.end());
+  auto name_hash = stable_hash(name);
+  auto sequence = control().sequence + 1;
+  auto members = [this](const RepositoryEntry &entry) {
+    return std::span(std::as_const(repository_versions_).data() + entry.version_begin, entry.version_count);
+  };
+
+  std::vector<VersionId> dropped;
+  auto current = current_repositories();
+  for (auto index : current)
+    if (repositories_[index].name_hash == name_hash)
+      std::ranges::set_difference(members(repositories_[index]), version_ids, std::back_inserter(dropped));
+  std::erase_if(dropped, [&](VersionId vid) {
+    if (tombstoned(vid)) return true;
+    return std::ranges::any_of(current, [&](std::size_t index) {
+      const auto &entry = repositories_[index];
+      return entry.name_hash != name_hash && std::ranges::binary_search(members(entry), vid);
+    });
+  });
+
+  dirty_ = true;
+  RepositoryEntry entry{
+    .sequence = sequence,
+    .name_hash = name_hash,
+    .version_begin = repository_versions_.size(),
+    .version_count = version_ids.size()
+  };
+  repository_versions_.append(version_ids.begin(), version_ids.end());
+  repositories_.push_back(entry);
+  if (!dropped.empty()) tombstone(dropped);
+}
+
+void DiskGraph::tombstone(const std::vector<VersionId> &version_ids) {
+  auto sequence = control().sequence + 1;
+  for (auto vid : version_ids) tombstone_log_.push_back({.sequence = sequence, .version_id = vid});
+  // Bits may only run ahead of the log, so recovery can rebuild them from what was committed.
+  tombstone_log_.sync(durability_);
+  logged_tombstones_.store(tombstone_log_.size(), std::memory_order_release);
+  for (auto vid : version_ids)
+    std::atomic_ref(tombstones_[vid / 64]).fetch_or(std::uint64_t(1) << vid % 64, std::memory_order_release);
+}
+
+bool DiskGraph::tombstoned(VersionId vid, const Snapshot &snapshot) const noexcept {
+  return tombstoned_at(vid, snapshot.sequence());
+}
+
+bool DiskGraph::tombstoned_at(VersionId vid, std::size_t sequence) const noexcept {
+  auto &bits = const_cast<std::uint64_t &>(tombstones_[vid / 64]);
+  if (!(std::atomic_ref(bits).load(std::memory_order_acquire) >> vid % 64 & 1)) return false;
+  // The bit is set at logging time; an entry logged after the sequence sits in the tail and does not count yet.
+  const auto &log = std::as_const(tombstone_log_);
+  for (auto index = logged_tombstones_.load(std::memory_order_acquire); index-- > 0 && log[index].sequence > sequence;)
+    if (log[index].version_id == vid) return false;
+  return true;
+}
+
+void DiskGraph::rebuild_tombstones() {
+  tombstones_.clear();
+  tombstones_.resize((version_count() + 63) / 64);
+  for (const auto &entry : std::as_const(tombstone_log_))
+    tombstones_[entry.version_id / 64] |= std::uint64_t(1) << entry.version_id % 64;
+  logged_tombstones_.store(tombstone_log_.size(), std::memory_order_release);
+}
+
+bool DiskGraph::has_repository(std::string_view name) const {
+  auto name_hash = stable_hash(name);
+  auto log = std::span(std::as_const(repositories_).data(), visible_size(repositories_));
+  return std::ranges::any_of(log, [name_hash](const RepositoryEntry &entry) {
+    return entry.name_hash == name_hash;
+  });
+}
+
+void DiskGraph::rebuild_source_index() {
+  source_index_.clear();
+  for (std::size_t index = 0, count = visible_size(sources_); index < count; ++index)
+    source_index_[std::as_const(sources_)[index].source.path_hash] = index;
+}
+
+std::optional<SourceFile> DiskGraph::find_source(std::uint64_t path_hash) const {
+  auto it = source_index_.find(path_hash);
+  if (it == source_index_.end()) return std::nullopt;
+  return sources_[it->second].source;
+}
+
+void DiskGraph::record_source(const SourceFile &source) {
+  if (read_only()) throw std::system_error(std::make_error_code(std::errc::read_only_file_system));
+  dirty_ = true;
+  auto &entry = sources_.push_back({.sequence = control().sequence + 1, .source = source});
+  entry.source.tombstone_count = tombstone_count();
+  source_index_[source.path_hash] = sources_.size() - 1;
+}
+
+std::optional<VersionId> DiskGraph::find_stanza(std::uint64_t content_hash, std::string_view package,
+                                                std::string_view version, std::string_view architecture) const {
+  if (!stanza_index_.is_open()) return std::nullopt;
+  auto key = stanza_index_.find(content_hash, [&, this](StanzaKey key) {
+    if (key.content_hash != content_hash || key.version_id >= version_count() || tombstoned(key.version_id))
+      return false;
+    const auto &vnode = version_nodes_[key.version_id];
+    const auto &pnode = package_nodes_[version_packages_[key.version_id]];
+    return architectures_[vnode.architecture] == architecture
+      && string_pool_.equal(vnode.version_offset, vnode.version_length, version)
+      && string_pool_.equal(pnode.name_offset, pnode.name_length, package);
+  });
+  if (key) return key->version_id;
+  return std::nullopt;
 }
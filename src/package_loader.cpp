@@ -1,16 +1,46 @@
 #include "package_loader.hpp"
+#include <algorithm>
 #include <chrono>
+#include <cstdint>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
 #include <ranges>
 #include <string>
 #include <string_view>
-#include <unordered_map>
 #include <vector>
 #include <nlohmann/json.hpp>
+#include "bounded_queue.hpp"
+#include "deb822_scanner.hpp"
 #include "dependency_graph.hpp"
 #include "util.hpp"
 
-auto PackageLoader::parse_dependency(std::string_view raw_dep, GroupId group) const noexcept -> DependencyItem {
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+
+std::string_view PackageLoader::input_view(const mio::mmap_source &input) noexcept {
+  return input.is_mapped() ? std::string_view(input.data(), input.size()) : std::string_view();
+}
+
+// Pages of a read-only file mapping are read back from the file if touched again, so dropping them is always safe.
+void PackageLoader::release_input(std::string_view region) noexcept {
+  auto page_size = mio::page_size();
+  auto begin = reinterpret_cast<std::uintptr_t>(region.data()) / page_size * page_size;
+  auto end = (reinterpret_cast<std::uintptr_t>(region.data()) + region.size()) / page_size * page_size;
+  if (end <= begin) return;
+#if defined(_WIN32)
+  // Unlocking pages that were never locked removes them from the working set.
+  ::VirtualUnlock(reinterpret_cast<void *>(begin), end - begin);
+#else
+  ::madvise(reinterpret_cast<void *>(begin), end - begin, MADV_DONTNEED);
+#endif
+}
+
+auto PackageLoader::parse_dependency(std::string_view raw_dep, DependencyType dtype, GroupId group,
+                                     bool lookup) const noexcept -> DependencyItem {
   std::string_view vcons;
   auto lpar = raw_dep.find('(');
   if (lpar != std::string_view::npos) {
@@ -25,108 +55,454 @@ auto PackageLoader::parse_dependency(std::string_view raw_dep, GroupId group) co
   return {
     .package_name = trim(name_and_arch.substr(0, colon)),
     .version_constraint = vcons,
-    .architecture_constraint = graph_.add_architecture(arch),
+    .architecture_name = arch,
+    .architecture_constraint = lookup ? graph_.architectures().id(arch) : std::nullopt,
+    .dependency_type = dtype,
     .group = group
   };
 }
 
-auto PackageLoader::parse_dependencies(std::string_view raw_deps, GroupId &group) const noexcept
-  -> std::vector<DependencyItem> {
-  std::vector<DependencyItem> result;
+void PackageLoader::parse_dependencies(std::string_view raw_deps, DependencyType dtype, GroupId &group, bool lookup,
+                                       std::vector<DependencyItem> &items) const noexcept {
   for (auto and_ : raw_deps | std::views::split(',')) {
     auto or_s = and_ | std::views::split('|');
     if (std::ranges::distance(or_s) > 1) {
       for (auto or_ : or_s) {
         std::string_view raw_dep(or_.begin(), or_.end());
-        result.emplace_back(parse_dependency(raw_dep, group));
+        items.emplace_back(parse_dependency(raw_dep, dtype, group, lookup));
       }
       group++;
     } else {
       std::string_view raw_dep(and_.begin(), and_.end());
-      result.emplace_back(parse_dependency(raw_dep, 0));
+      items.emplace_back(parse_dependency(raw_dep, dtype, 0, lookup));
     }
   }
-  return result;
 }
 
-void PackageLoader::load_package(std::string_view raw_package) const noexcept {
-  if (trim(raw_package).empty()) return;
-  std::unordered_map<std::string_view, std::string_view> field_table;
-  for (auto line : raw_package | std::views::split('\n')) {
-    if (line.empty()) continue;
-    std::string_view lview(line.begin(), line.end());
-    auto colon = lview.find(':');
-    if (colon != std::string_view::npos)
-      field_table.emplace(trim(lview.substr(0, colon)), trim(lview.substr(colon + 1)));
-  }
-
-  auto nit = field_table.find("Package");
-  if (nit == field_table.end()) return;
-  auto [pid, psucc] = graph_.create_package(nit->second);
-  auto ait = field_table.find("Architecture");
-  if (ait == field_table.end()) return;
-  ArchitectureType arch = graph_.add_architecture(ait->second);
-  auto vit = field_table.find("Version");
-  if (vit == field_table.end()) return;
-  auto [vid, vsucc] = graph_.create_version(pid, vit->second, arch);
-  GroupId group = 1;
-
-  for (DependencyType dtype = 0; dtype < graph_.dependency_type_count(); ++dtype) {
-    auto dtview = graph_.dependency_types()[dtype];
-    auto it = field_table.find(dtview);
-    if (it == field_table.end()) continue;
-    for (auto item : parse_dependencies(it->second, group)) {
-      auto [tpid, dpsucc] = graph_.create_package(item.package_name);
-      graph_.create_dependency(vid, tpid, item.version_constraint, item.architecture_constraint, dtype, item.group);
+void PackageLoader::load_package(std::string_view raw_package) const noexcept { load_package(raw_package, nullptr); }
+
+void PackageLoader::load_package(std::string_view raw_package, std::vector<VersionId> *version_ids) const noexcept {
+  auto fields = field_names();
+  std::vector<std::optional<std::string_view>> values(fields.size());
+  std::string_view stanza;
+  deb822_scanner(raw_package, fields).next(stanza, values);
+  StagedChunk chunk;
+  stage_stanza(raw_package, values, true, chunk);
+  for (const auto &staged : chunk.stanzas) load_stanza(staged, chunk.dependencies, version_ids);
+}
+
+std::vector<std::string_view> PackageLoader::field_names() const {
+  std::vector<std::string_view> fields{"Package", "Version", "Architecture"};
+  for (DependencyType dtype = 0; dtype < graph_.dependency_type_count(); ++dtype)
+    fields.push_back(graph_.dependency_types()[dtype]);
+  return fields;
+}
+
+void PackageLoader::stage_stanza(std::string_view stanza, std::span<const std::optional<std::string_view>> values,
+                                 bool lookup, StagedChunk &chunk) const noexcept {
+  if (trim(stanza).empty()) return;
+  auto &staged = chunk.stanzas.emplace_back(StagedStanza{
+    .content_hash = content_hash(stanza),
+    .version_id = std::nullopt,
+    .package_name = values[kPackageField],
+    .version = values[kVersionField],
+    .architecture = values[kArchitectureField],
+    .dependency_end = 0
+  });
+  if (staged.package_name && staged.version && staged.architecture) {
+    if (lookup) staged.version_id = find_stanza(staged);
+    if (!staged.version_id) {
+      GroupId group = 1;
+      for (DependencyType dtype = 0; dtype < values.size() - kDependencyFields; ++dtype)
+        if (const auto &value = values[kDependencyFields + dtype])
+          parse_dependencies(*value, dtype, group, lookup, chunk.dependencies);
     }
   }
+  staged.dependency_end = chunk.dependencies.size();
 }
 
-void PackageLoader::load_packages(std::string_view raw_packages) const noexcept {
-  for (auto raw_package : raw_packages | std::views::split(std::string_view("\n\n"))) {
-    std::string_view pview(raw_package.begin(), raw_package.end());
-    load_package(pview);
+auto PackageLoader::stage_packages(std::string_view raw_packages, std::span<const std::string_view> fields,
+                                   bool lookup) const noexcept -> StagedChunk {
+  StagedChunk chunk;
+  std::vector<std::optional<std::string_view>> values(fields.size());
+  deb822_scanner scanner(raw_packages, fields);
+  for (std::string_view stanza; scanner.next(stanza, values);) stage_stanza(stanza, values, lookup, chunk);
+  return chunk;
+}
+
+std::optional<VersionId> PackageLoader::find_stanza(const StagedStanza &stanza) const {
+  if (!stanza.package_name || !stanza.version || !stanza.architecture) return std::nullopt;
+  return graph_.find_stanza(stanza.content_hash, *stanza.package_name, *stanza.version, *stanza.architecture);
+}
+
+void PackageLoader::load_stanza(const StagedStanza &stanza, std::span<const DependencyItem> dependencies,
+                                std::vector<VersionId> *version_ids) const noexcept {
+  // A miss at parse time is checked again, since an earlier flush may have committed an identical stanza since.
+  auto found = stanza.version_id ? stanza.version_id : find_stanza(stanza);
+  if (found) {
+    if (version_ids) version_ids->push_back(*found);
+    return;
+  }
+
+  if (!stanza.package_name) return;
+  auto [pid, psucc] = graph_.create_package(*stanza.package_name);
+  if (!stanza.architecture) return;
+  ArchitectureType arch = graph_.add_architecture(*stanza.architecture);
+  if (!stanza.version) return;
+  auto [vid, vsucc] = graph_.create_version(pid, *stanza.version, arch, stanza.content_hash);
+
+  for (const auto &item : dependencies) {
+    auto acons = item.architecture_constraint ? *item.architecture_constraint
+                                              : graph_.add_architecture(item.architecture_name);
+    auto [tpid, dpsucc] = graph_.create_package(item.package_name);
+    graph_.create_dependency(vid, tpid, item.version_constraint, acons, item.dependency_type, item.group);
   }
 }
 
-bool PackageLoader::load_packages_file(const std::filesystem::path &path, bool verbose) const noexcept {
-  std::ifstream file(path);
-  if (!file.good()) {
-    if (verbose) println(std::cerr, "Failed to open packages file: {}.", path.string());
-    return false;
+void PackageLoader::load_packages(std::string_view raw_packages) const noexcept {
+  load_packages(raw_packages, nullptr);
+}
+
+auto PackageLoader::load_packages(std::string_view raw_packages, std::vector<VersionId> *version_ids) const noexcept
+  -> LoadStats {
+  // Chunks are parsed in parallel against a graph that nothing modifies meanwhile, then loaded one after another.
+  auto fields = field_names();
+  auto chunk_count = std::min(std::max<std::size_t>(parse_threads_, 1), raw_packages.size() / kMinParseChunkBytes + 1);
+  std::vector<std::string_view> inputs;
+  for (auto rest = raw_packages; !rest.empty();) {
+    inputs.push_back(stanza_prefix(rest, raw_packages.size() / chunk_count + 1));
+    rest.remove_prefix(inputs.back().size());
   }
+  std::vector<StagedChunk> chunks(inputs.size());
+  if (inputs.size() == 1) chunks.front() = stage_packages(inputs.front(), fields, true);
+  else if (inputs.size() > 1) {
+    std::vector<std::future<void>> pending;
+    for (std::size_t i = 0; i < inputs.size(); ++i)
+      pending.emplace_back(std::async(std::launch::async, [this, &inputs, &chunks, &fields, i] {
+        chunks[i] = stage_packages(inputs[i], fields, true);
+      }));
+    for (auto &future : pending) future.get();
+  }
+
+  LoadStats stats;
+  for (const auto &chunk : chunks) stats += load_staged(chunk, version_ids);
+  return stats;
+}
+
+auto PackageLoader::load_staged(const StagedChunk &chunk, std::vector<VersionId> *version_ids) const noexcept
+  -> LoadStats {
+  LoadStats stats;
   std::size_t pcount = graph_.buffer_package_count();
   std::size_t vcount = graph_.buffer_version_count();
   std::size_t dcount = graph_.buffer_dependency_count();
-  if (verbose) print("Loading packages file: {}... ", path.string());
-  auto load_time = measure_time<std::chrono::milliseconds>([this, &file] {
-    file.seekg(0, std::ios::end);
-    auto file_size = file.tellg();
-    file.seekg(0);
-    std::string raw_pkgs(file_size, '\0');
-    file.read(raw_pkgs.data(), file_size);
-    load_packages(raw_pkgs);
-  });
-  if (verbose) println("Done. ({} ms)", load_time.count());
-  pcount = graph_.buffer_package_count() - pcount;
-  vcount = graph_.buffer_version_count() - vcount;
-  dcount = graph_.buffer_dependency_count() - dcount;
+  auto tally = [&] {
+    stats.package_count += graph_.buffer_package_count() - pcount;
+    stats.version_count += graph_.buffer_version_count() - vcount;
+    stats.dependency_count += graph_.buffer_dependency_count() - dcount;
+    pcount = vcount = dcount = 0;
+  };
+  // Memory usage is O(1), so it is checked per stanza and a large file cannot run far past the limit. Below a floor
+  // the check waits for the end of the file, so a tiny limit still flushes per file instead of every few stanzas.
+  auto limit = std::max(graph_.memory_limit(), kMinMidFileFlushBytes);
+  std::span<const DependencyItem> dependencies(chunk.dependencies);
+  std::size_t dependency_begin = 0;
+  for (const auto &stanza : chunk.stanzas) {
+    load_stanza(stanza, dependencies.subspan(dependency_begin, stanza.dependency_end - dependency_begin), version_ids);
+    dependency_begin = stanza.dependency_end;
+    if (graph_.memory_usage() < limit) continue;
+    tally();
+    if (!version_ids) stats.flush_count += graph_.flush_buffer_if_needed();
+    else {
+      graph_.flush_buffer(*version_ids);
+      ++stats.flush_count;
+    }
+  }
+  tally();
+  return stats;
+}
+
+std::string_view PackageLoader::stanza_prefix(std::string_view text, std::size_t min_bytes) noexcept {
+  // Prefixes end just past a stanza separator, so consecutive ones split into the same stanzas as the whole text.
+  for (auto newline = text.find('\n', std::min(min_bytes, text.size())); newline != std::string_view::npos;
+       newline = text.find('\n', newline + 1)) {
+    auto rest = text.substr(newline);
+    if (rest.starts_with("\n\n")) return text.substr(0, newline + 2);
+    if (rest.starts_with("\n\r\n")) return text.substr(0, newline + 3);
+  }
+  return text;
+}
+
+auto PackageLoader::load_input(const mio::mmap_source &input, std::vector<VersionId> *version_ids) const noexcept
+  -> LoadStats {
+  LoadStats stats;
+  auto raw_pkgs = input_view(input);
+  while (!raw_pkgs.empty()) {
+    auto region = stanza_prefix(raw_pkgs, kInputRegionBytes);
+    stats += load_packages(region, version_ids);
+    release_input(region);
+    raw_pkgs.remove_prefix(region.size());
+  }
+  return stats;
+}
+
+auto PackageLoader::read_source(const std::filesystem::path &path, const std::optional<SourceFile> &recorded,
+                                bool hash_changed, SourceFile &source, mio::mmap_source &input) const noexcept
+  -> source_state {
+  std::error_code error;
+  source.size = std::filesystem::file_size(path, error);
+  if (!error) source.mtime = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+  if (!error && recorded && recorded->size == source.size && recorded->mtime == source.mtime) return kSourceUnchanged;
+
+  // An empty file cannot be mapped and parses to nothing.
+  if (error || source.size > 0) {
+    input.map(path.string(), error);
+    if (error) return kSourceFailed;
+#if !defined(_WIN32)
+    ::madvise(const_cast<char *>(input.data()), input.mapped_length(), MADV_SEQUENTIAL);
+#endif
+  }
+  // The size is hashed too, so only a file of the recorded size can hold the recorded contents.
+  auto rewrite = recorded && recorded->size == source.size;
+  if (!rewrite && !hash_changed) return kSourceChanged;
+  source.content_hash = content_hash(input_view(input));
+  return rewrite && recorded->content_hash == source.content_hash ? kSourceRewritten : kSourceChanged;
+}
+
+bool PackageLoader::source_current(const std::filesystem::path &path, bool repository,
+                                   const std::optional<SourceFile> &recorded) const noexcept {
+  return recorded
+    && (repository ? recorded->repository && graph_.has_repository(path.string())
+                   : recorded->tombstone_count == graph_.tombstone_count());
+}
+
+auto PackageLoader::read_packages_file(const std::filesystem::path &path, bool verbose, bool repository,
+                                       SourceFile &source, mio::mmap_source &input) const noexcept -> source_state {
+  if (graph_.read_only()) {
+    if (verbose) println(std::cerr, "Cannot load packages file into a read-only graph: {}.", path.string());
+    return kSourceFailed;
+  }
+  source = {.path_hash = stable_hash(path.string()), .repository = repository};
+  auto recorded = graph_.find_source(source.path_hash);
+  if (!source_current(path, repository, recorded)) recorded.reset();
+  auto state = read_source(path, recorded, true, source, input);
+  if (state == kSourceFailed && verbose) println(std::cerr, "Failed to open packages file: {}.", path.string());
+  if (state != kSourceRewritten) return state;
+  graph_.record_source(source);
+  return kSourceUnchanged;
+}
 
-  auto memory_usage = graph_.estimated_memory_usage();
-  if (memory_usage >= graph_.memory_limit()) {
+void PackageLoader::load_source(const std::filesystem::path &path, const SourceFile &source, bool verbose,
+                                const std::function<LoadStats(std::vector<VersionId> *)> &load) const {
+  if (source.repository) {
+    graph_.flush_buffer();
+    std::size_t vcount = graph_.version_count();
+    std::size_t tcount = graph_.tombstone_count();
+    if (verbose) print("Refreshing packages file: {}... ", path.string());
+    auto refresh_time = measure_time<std::chrono::milliseconds>([this, &path, &source, &load] {
+      std::vector<VersionId> version_ids;
+      load(&version_ids);
+      graph_.record_source(source);
+      graph_.replace_repository(path.string(), std::move(version_ids));
+    });
     if (verbose)
-      print("Estimated memory usage {:.1f} MiB exceeded limit {} MiB. Flushing to disk... ",
-            memory_usage / MiB_d, graph_.memory_limit() / MiB);
-    auto flush_time = measure_time<std::chrono::milliseconds>([this] { graph_.flush_buffer(); });
-    if (verbose) println("Done. ({:.3f} ms)", flush_time.count() / 1000.0);
+      println("Done. ({} ms) Added {} versions, tombstoned {} versions.", refresh_time.count(),
+              graph_.version_count() - vcount, graph_.tombstone_count() - tcount);
+    return;
   }
-  if (verbose)
+
+  if (verbose) print("Loading packages file: {}... ", path.string());
+  auto [stats, load_time] = measure_time<std::chrono::milliseconds>([&load] { return load(nullptr); });
+  if (verbose) println("Done. ({} ms)", load_time.count());
+  graph_.record_source(source);
+  stats.flush_count += graph_.flush_buffer_if_needed();
+  if (verbose && stats.flush_count > 0)
+    println("Memory usage reached the {} MiB limit; flushed to disk {} times.", graph_.memory_limit() / MiB,
+            stats.flush_count);
+  if (verbose) {
+    // A background flush may still be growing the disk graph, so the totals are those last committed.
+    auto snapshot = graph_.snapshot();
     println("Loaded {} packages, {} versions, {} dependencies. Total {} packages, {} versions, {} dependencies.",
-            pcount, vcount, dcount, graph_.package_count(), graph_.version_count(), graph_.dependency_count());
+            stats.package_count, stats.version_count, stats.dependency_count, snapshot.package_count(),
+            snapshot.version_count(), snapshot.dependency_count());
+  }
+}
+
+bool PackageLoader::load_source_file(const std::filesystem::path &path, bool verbose, bool repository) const noexcept {
+  SourceFile source;
+  mio::mmap_source input;
+  auto state = read_packages_file(path, verbose, repository, source, input);
+  if (state == kSourceFailed) return false;
+  if (state == kSourceUnchanged) {
+    if (verbose) println("Skipped unchanged packages file: {}.", path.string());
+    return true;
+  }
+  load_source(path, source, verbose, [this, &input](std::vector<VersionId> *version_ids) {
+    return load_input(input, version_ids);
+  });
   return true;
 }
 
+bool PackageLoader::load_packages_file(const std::filesystem::path &path, bool verbose) const noexcept {
+  return load_source_file(path, verbose, false);
+}
+
+bool PackageLoader::refresh_packages_file(const std::filesystem::path &path, bool verbose) const noexcept {
+  return load_source_file(path, verbose, true);
+}
+
+std::size_t PackageLoader::load_source_files(const std::vector<std::string> &paths, bool verbose, bool repository,
+                                             StageTimes &times) const noexcept {
+  using clock = std::chrono::steady_clock;
+  struct InputFile {
+    std::filesystem::path path;
+    SourceFile source;
+    std::optional<SourceFile> recorded;
+    mio::mmap_source input;
+    source_state state;
+  };
+  // A changed file is queued as one or more regions, the last one marked; any other file as a single empty one.
+  struct InputRegion {
+    std::shared_ptr<InputFile> file;
+    std::string_view text;
+    std::future<StagedChunk> staged;
+    bool last;
+  };
+  // Holds its file too, so the mapping outlives the task even when the file's regions are not applied.
+  struct ParseTask {
+    std::shared_ptr<InputFile> file;
+    std::string_view text;
+    std::promise<StagedChunk> staged;
+  };
+
+  // Regions are pushed for applying before they are pushed for parsing, so the apply queue bounds everything read
+  // ahead, and parsers never wait on the apply stage.
+  auto parser_count = std::max<std::size_t>(parse_threads_, 1);
+  bounded_queue<InputRegion> apply_queue(parser_count + 2);
+  bounded_queue<ParseTask> parse_queue(parser_count + 2);
+  auto fields = field_names();
+  // A file's recorded source, and whether it is current, only change once a file with the same path is applied. Both
+  // are looked up front so the reader never touches the graph, and a file whose record changed meanwhile is loaded
+  // again from scratch.
+  std::vector<std::optional<SourceFile>> recorded;
+  std::vector<bool> current;
+  for (const auto &path : paths) {
+    recorded.push_back(graph_.find_source(stable_hash(path)));
+    current.push_back(source_current(path, repository, recorded.back()));
+  }
+
+  auto reader = std::async(std::launch::async, [&] {
+    clock::duration busy{};
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+      auto start = clock::now();
+      auto file = std::make_shared<InputFile>();
+      file->path = paths[i];
+      file->source = {.path_hash = stable_hash(paths[i]), .repository = repository};
+      file->recorded = recorded[i];
+      file->state = read_source(file->path, current[i] ? recorded[i] : std::nullopt, false, file->source,
+                                file->input);
+      busy += clock::now() - start;
+      if (file->state != kSourceChanged) {
+        apply_queue.push({.file = std::move(file), .text = {}, .staged = {}, .last = true});
+        continue;
+      }
+      // A changed file is hashed region by region as it is queued, so reading ahead stays bounded by the apply queue.
+      // The apply stage records the hash only after popping the last region.
+      auto rest = input_view(file->input);
+      content_hasher hasher(rest.size());
+      do {
+        start = clock::now();
+        auto text = stanza_prefix(rest, kPipelineRegionBytes);
+        rest.remove_prefix(text.size());
+        hasher.update(text);
+        if (rest.empty()) file->source.content_hash = hasher.finish();
+        busy += clock::now() - start;
+        std::promise<StagedChunk> staged;
+        apply_queue.push({.file = file, .text = text, .staged = staged.get_future(), .last = rest.empty()});
+        parse_queue.push({.file = file, .text = text, .staged = std::move(staged)});
+      } while (!rest.empty());
+    }
+    apply_queue.close();
+    parse_queue.close();
+    return busy;
+  });
+
+  // Parsers leave the graph alone, since the apply stage modifies it meanwhile.
+  std::vector<std::future<clock::duration>> parsers;
+  for (std::size_t i = 0; i < parser_count; ++i)
+    parsers.emplace_back(std::async(std::launch::async, [this, &parse_queue, &fields] {
+      clock::duration busy{};
+      while (auto task = parse_queue.pop()) {
+        auto start = clock::now();
+        task->staged.set_value(stage_packages(task->text, fields, false));
+        busy += clock::now() - start;
+      }
+      return busy;
+    }));
+
+  std::size_t count = 0;
+  clock::duration wait{};
+  auto next_region = [&apply_queue, &wait] {
+    auto start = clock::now();
+    auto region = apply_queue.pop();
+    wait += clock::now() - start;
+    return region;
+  };
+  auto apply_start = clock::now();
+  while (auto region = next_region()) {
+    auto file = region->file;
+    if (file->state == kSourceFailed) {
+      if (verbose) println(std::cerr, "Failed to open packages file: {}.", file->path.string());
+      continue;
+    }
+    if (graph_.find_source(file->source.path_hash) != file->recorded) {
+      while (!region->last) region = next_region();
+      count += load_source_file(file->path, verbose, repository);
+      continue;
+    }
+    if (file->state != kSourceChanged) {
+      if (file->state == kSourceRewritten) graph_.record_source(file->source);
+      if (verbose) println("Skipped unchanged packages file: {}.", file->path.string());
+      ++count;
+      continue;
+    }
+    auto load = [this, &region, &next_region, &wait](std::vector<VersionId> *version_ids) {
+      LoadStats stats;
+      for (;;) {
+        auto start = clock::now();
+        auto chunk = region->staged.get();
+        wait += clock::now() - start;
+        stats += load_staged(chunk, version_ids);
+        release_input(region->text);
+        if (region->last) return stats;
+        region = next_region();
+      }
+    };
+    load_source(file->path, file->source, verbose, load);
+    ++count;
+  }
+  auto apply_busy = clock::now() - apply_start - wait;
+
+  using std::chrono::duration_cast;
+  times.read = duration_cast<std::chrono::milliseconds>(reader.get());
+  for (auto &parser : parsers) times.parse += duration_cast<std::chrono::milliseconds>(parser.get());
+  times.apply = duration_cast<std::chrono::milliseconds>(apply_busy);
+  times.apply_wait = duration_cast<std::chrono::milliseconds>(wait);
+  return count;
+}
+
 bool PackageLoader::load_dataset_file(const std::filesystem::path &path, bool verbose) const noexcept {
+  return load_dataset(path, verbose, false);
+}
+
+bool PackageLoader::refresh_dataset_file(const std::filesystem::path &path, bool verbose) const noexcept {
+  return load_dataset(path, verbose, true);
+}
+
+bool PackageLoader::load_dataset(const std::filesystem::path &path, bool verbose, bool refresh) const noexcept {
+  if (graph_.read_only()) {
+    if (verbose) println(std::cerr, "Cannot load dataset file into a read-only graph: {}.", path.string());
+    return false;
+  }
   std::ifstream file(path);
   if (!file.good()) {
     if (verbose) println(std::cerr, "Failed to open dataset file: {}.", path.string());
@@ -142,12 +518,18 @@ bool PackageLoader::load_dataset_file(const std::filesystem::path &path, bool ve
     if (it != item.end()) to_load.emplace_back(std::move(it.value()));
   }
 
-  if (verbose) println("Loading {} packages files...", to_load.size());
-  auto [load_count, load_time] = measure_time<std::chrono::milliseconds>([this, &to_load, verbose] {
-    std::size_t count = 0;
-    for (auto &filename : to_load) count += load_packages_file(std::move(filename), verbose);
+  if (verbose) println("{} {} packages files...", refresh ? "Refreshing" : "Loading", to_load.size());
+  StageTimes times;
+  auto [load_count, load_time] = measure_time<std::chrono::milliseconds>([this, &to_load, verbose, refresh, &times] {
+    auto count = load_source_files(to_load, verbose, refresh, times);
+    graph_.wait_flush();
     return count;
   });
-  if (verbose) println("Loaded {} packages files. ({} s)", load_count, load_time.count() / 1000.0);
+  if (verbose) {
+    println("{} {} packages files. ({} s)", refresh ? "Refreshed" : "Loaded", load_count, load_time.count() / 1000.0);
+    println("Stage times: read {} ms, parse {} ms over {} threads, apply {} ms; applying waited {} ms for input.",
+            times.read.count(), times.parse.count(), std::max<std::size_t>(parse_threads_, 1), times.apply.count(),
+            times.apply_wait.count());
+  }
   return true;
 }
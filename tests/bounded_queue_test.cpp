@@ -0,0 +1,91 @@
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <thread>
+#include <vector>
+#include "bounded_queue.hpp"
+#include "util.hpp"
+
+namespace {
+
+constexpr int kProducers = 4;
+constexpr int kConsumers = 3;
+constexpr int kItems = 20000;
+
+bool fifo_and_drain() {
+  bounded_queue<int> queue(3);
+  for (int i = 0; i < 3; ++i) queue.push(i);
+  queue.close();
+  if (queue.push(3)) {
+    println("A closed queue accepted a push.");
+    return false;
+  }
+  for (int i = 0; i < 3; ++i) {
+    if (queue.pop() != i) {
+      println("A closed queue did not drain its items in order.");
+      return false;
+    }
+  }
+  if (queue.pop() || queue.pop()) {
+    println("A drained closed queue returned an item.");
+    return false;
+  }
+  return true;
+}
+
+bool close_wakes_waiters() {
+  bounded_queue<int> empty(1);
+  auto pop = std::async(std::launch::async, [&empty] { return empty.pop(); });
+  bounded_queue<int> full(0);
+  if (full.capacity() != 1 || !full.push(0)) {
+    println("A queue of capacity 0 did not hold one item.");
+    return false;
+  }
+  auto push = std::async(std::launch::async, [&full] { return full.push(1); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  empty.close();
+  full.close();
+  if (pop.get() || push.get()) {
+    println("Closing did not fail a blocked pop and a blocked push.");
+    return false;
+  }
+  if (full.pop() != 0 || full.pop()) {
+    println("The item pushed before closing was not drained exactly once.");
+    return false;
+  }
+  return true;
+}
+
+// Every item pushed before closing is popped exactly once, whatever the interleaving.
+bool producers_and_consumers() {
+  bounded_queue<int> queue(4);
+  std::vector<std::future<std::int64_t>> consumers;
+  for (int i = 0; i < kConsumers; ++i)
+    consumers.emplace_back(std::async(std::launch::async, [&queue] {
+      std::int64_t sum = 0;
+      while (auto item = queue.pop()) sum += *item;
+      return sum;
+    }));
+  std::vector<std::thread> producers;
+  for (int i = 0; i < kProducers; ++i)
+    producers.emplace_back([&queue, i] {
+      for (int item = i; item < kItems; item += kProducers) queue.push(item);
+    });
+  for (auto &producer : producers) producer.join();
+  queue.close();
+  std::int64_t sum = 0;
+  for (auto &consumer : consumers) sum += consumer.get();
+  if (sum != std::int64_t(kItems) * (kItems - 1) / 2) {
+    println("Consumers popped items summing to {}, expected {}.", sum, std::int64_t(kItems) * (kItems - 1) / 2);
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+int main() {
+  if (!fifo_and_drain() || !close_wakes_waiters() || !producers_and_consumers()) return 1;
+  println("Bounded queue test passed.");
+  return 0;
+}
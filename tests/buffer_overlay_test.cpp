@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <format>
+#include <limits>
+#include <random>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "dependency_graph.hpp"
+#include "package_loader.hpp"
+#include "util.hpp"
+
+namespace {
+
+constexpr std::size_t kPackages = 300;
+constexpr std::size_t kMaxDepth = 3;
+constexpr std::string_view kArchitectures[] = {"amd64", "all", "i386"};
+
+// Stanzas for every package whose index is congruent to first modulo step, with dependencies drawn from gen.
+std::string packages(std::size_t first, std::size_t step, std::string_view version, std::mt19937 &gen) {
+  std::uniform_int_distribution<std::size_t> pick(0, kPackages - 1);
+  std::string text;
+  for (auto i = first; i < kPackages; i += step) {
+    text += std::format("Package: pkg{}\nVersion: {}\nArchitecture: {}\n", i, version, kArchitectures[i % 3]);
+    text += std::format("Depends: pkg{} (>= {}), pkg{} | pkg{}:any, pkg{}\n", pick(gen), version, pick(gen),
+                        pick(gen), pick(gen));
+    text += std::format("Recommends: pkg{}\n\n", pick(gen));
+  }
+  return text;
+}
+
+std::string describe(const DependencyItem &item) {
+  return std::format("{} {} ({}) [{}]", item.package_name, item.dependency_type, item.version_constraint,
+                     item.architecture_constraint);
+}
+
+// One line per direct dependency and per alternative group, prefixed by level, in a fixed order.
+std::vector<std::string> canonical(const DependencyResult &result) {
+  std::vector<std::string> lines;
+  for (std::size_t level = 0; level < result.size(); ++level) {
+    for (const auto &item : result[level].direct_dependencies)
+      lines.push_back(std::format("{} {}", level, describe(item)));
+    for (const auto &group : result[level].or_dependencies) {
+      std::vector<std::string> items;
+      for (const auto &item : group) items.push_back(describe(item));
+      std::ranges::sort(items);
+      auto line = std::to_string(level);
+      for (const auto &item : items) line += " | " + item;
+      lines.push_back(std::move(line));
+    }
+  }
+  std::ranges::sort(lines);
+  return lines;
+}
+
+std::vector<std::vector<std::string>> query_all(const DependencyGraph &graph) {
+  std::vector<std::vector<std::string>> results;
+  for (std::size_t i = 0; i < kPackages; ++i)
+    for (std::size_t depth = 1; depth <= kMaxDepth; ++depth)
+      results.push_back(canonical(graph.query_dependencies(std::format("pkg{}", i), "", "", depth, false)));
+  for (std::size_t i = 0; i < kPackages; i += 7) {
+    results.push_back(canonical(graph.query_dependencies(std::format("pkg{}", i), "1.0", "", kMaxDepth, false)));
+    results.push_back(
+      canonical(graph.query_dependencies(std::format("pkg{}", i), "2.0", "amd64", kMaxDepth, false)));
+  }
+  return results;
+}
+
+} // namespace
+
+int main() {
+  std::filesystem::remove_all("./temp/buffer_overlay_test");
+  std::filesystem::create_directories("./temp/buffer_overlay_test");
+  DependencyGraph graph(std::numeric_limits<std::size_t>::max());
+  if (!graph.open("./temp/buffer_overlay_test/graph", kCreate)) {
+    println("Failed to create DependencyGraph at directory: {}", "./temp/buffer_overlay_test/graph");
+    return 1;
+  }
+  graph.set_background_verify(false);
+  PackageLoader loader(graph);
+  std::mt19937 gen(42);
+  loader.load_packages(packages(0, 2, "1.0", gen));
+  graph.flush_buffer();
+
+  // Later loads only add versions of pkg2, so a reader querying it throughout must never lose what it saw before,
+  // however the flushes interleave with it.
+  std::atomic<bool> lost = false;
+  std::jthread reader([&](std::stop_token stop) {
+    std::vector<std::string> seen;
+    while (!stop.stop_requested()) {
+      auto lines = canonical(graph.query_dependencies("pkg2", "", "", 1, false));
+      if (!std::ranges::includes(lines, seen)) lost = true;
+      seen = std::move(lines);
+    }
+  });
+
+  // Buffered versions of new and flushed packages, and flushed versions loaded again with other dependencies, which
+  // replace them.
+  loader.load_packages(packages(0, 1, "2.0", gen));
+  loader.load_packages(packages(0, 4, "1.0", gen));
+  auto buffered = query_all(graph);
+  graph.flush_buffer();
+  if (graph.buffer_package_count() != 0 || query_all(graph) != buffered) {
+    println("Queries over the buffer differ from the same queries once it is flushed.");
+    return 1;
+  }
+
+  // A background flush leaves a second buffer, loaded meanwhile, on top of the one being flushed.
+  graph.set_background_flush(true);
+  loader.load_packages(packages(1, 2, "3.0", gen));
+  graph.set_memory_limit(0);
+  graph.flush_buffer_if_needed();
+  graph.set_memory_limit(std::numeric_limits<std::size_t>::max());
+  loader.load_packages(packages(0, 3, "4.0", gen));
+  buffered = query_all(graph);
+  graph.flush_buffer();
+  reader.request_stop();
+  reader.join();
+  if (query_all(graph) != buffered) {
+    println("Queries during a background flush differ from the same queries once it is committed.");
+    return 1;
+  }
+  if (lost) {
+    println("A query during loading lost dependencies an earlier one found.");
+    return 1;
+  }
+  println("Buffer overlay test passed.");
+  return 0;
+}
@@ -0,0 +1,120 @@
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "buffer_graph.hpp"
+#include "disk_graph.hpp"
+#include "util.hpp"
+
+namespace {
+
+// Adds versions of app and libfoo, app depending on libfoo, plus a version of extra if given.
+void fill(DiskGraph &graph, BufferGraph &buffer, std::string_view version, std::string_view extra = {}) {
+  auto arch = graph.add_architecture("amd64");
+  auto dtype = graph.add_dependency_type("Depends");
+  auto [app, app_created] = buffer.create_package("app");
+  auto [libfoo, libfoo_created] = buffer.create_package("libfoo");
+  auto [vid, version_created] = buffer.create_version(app, version, arch);
+  buffer.create_dependency(vid, libfoo, std::string(">= ") + std::string(version), arch, dtype, 0);
+  buffer.create_version(libfoo, version, arch);
+  if (!extra.empty()) buffer.create_version(buffer.create_package(extra).first, version, arch);
+}
+
+std::vector<std::string> versions(const DiskGraph &graph, std::string_view name) {
+  std::vector<std::string> result;
+  if (auto package = graph.get_package(name))
+    for (const auto &version : package->versions()) result.emplace_back(version.version);
+  return result;
+}
+
+} // namespace
+
+int main() {
+  std::filesystem::path dir = "./temp/crash_recovery_test/graph";
+  std::filesystem::path crashed_dir = "./temp/crash_recovery_test/crashed";
+  std::filesystem::remove_all("./temp/crash_recovery_test");
+  std::filesystem::create_directories("./temp/crash_recovery_test");
+  {
+    DiskGraph graph;
+    graph.set_background_verify(false);
+    if (graph.open(dir, kCreate) != kCreateSuccess) {
+      println("Failed to create DiskGraph at directory: {}", dir.string());
+      return 1;
+    }
+    BufferGraph buffer;
+    fill(graph, buffer, "1.0");
+    graph.ingest(buffer);
+    graph.commit();
+
+    // A second flush appends to the version lists of app and libfoo, which journals their old heads, and copying
+    // the files before its commit leaves them as a writer that crashed mid-flush would.
+    buffer.clear();
+    fill(graph, buffer, "2.0", "extra");
+    graph.ingest(buffer);
+    if (graph.version_count() != 5 || versions(graph, "app").size() != 2) {
+      println("The uncommitted flush did not ingest.");
+      return 1;
+    }
+    std::filesystem::copy(dir, crashed_dir, std::filesystem::copy_options::recursive);
+  }
+
+  DiskGraph recovered;
+  recovered.set_background_verify(false);
+  if (recovered.open(crashed_dir, kLoad) != kLoadSuccess) {
+    println("Failed to load the crashed DiskGraph at directory: {}", crashed_dir.string());
+    return 1;
+  }
+  if (recovered.package_count() != 2 || recovered.version_count() != 2 || recovered.dependency_count() != 1) {
+    println("Recovery kept {} packages, {} versions and {} dependencies, expected 2, 2 and 1.",
+            recovered.package_count(), recovered.version_count(), recovered.dependency_count());
+    return 1;
+  }
+  if (versions(recovered, "app") != std::vector<std::string>{"1.0"}
+    || versions(recovered, "libfoo") != std::vector<std::string>{"1.0"} || recovered.get_package("extra")) {
+    println("Recovery did not restore the journaled version list heads.");
+    return 1;
+  }
+  if (!recovered.verify()) {
+    println("Checksums of the recovered graph do not match.");
+    return 1;
+  }
+
+  // The truncated tail is written again by the next flush.
+  BufferGraph buffer;
+  fill(recovered, buffer, "2.0", "extra");
+  recovered.ingest(buffer);
+  recovered.commit();
+  recovered.close();
+  DiskGraph reopened;
+  reopened.set_background_verify(false);
+  if (reopened.open(crashed_dir, kLoad) != kLoadSuccess || reopened.version_count() != 5
+    || versions(reopened, "app").size() != 2 || versions(reopened, "extra") != std::vector<std::string>{"2.0"}
+    || !reopened.verify()) {
+    println("The flush after recovery did not commit.");
+    return 1;
+  }
+  reopened.close();
+
+  // A compaction that crashed between moving the graph aside and moving the compacted one in loses only the
+  // compaction, whether the graph is loaded read-only or recovered by a writer.
+  std::filesystem::path staging = crashed_dir.string() + ".compact";
+  std::filesystem::path retired = crashed_dir.string() + ".old";
+  std::filesystem::copy(crashed_dir, staging, std::filesystem::copy_options::recursive);
+  std::filesystem::rename(crashed_dir, retired);
+  DiskGraph reader;
+  reader.set_background_verify(false);
+  if (reader.open(crashed_dir, kReadOnly) != kLoadSuccess || reader.version_count() != 5) {
+    println("A read-only load did not find the graph a crashed compaction moved aside.");
+    return 1;
+  }
+  reader.close();
+  DiskGraph restored;
+  restored.set_background_verify(false);
+  if (restored.open(crashed_dir, kLoad) != kLoadSuccess || restored.version_count() != 5 || !restored.verify()
+    || !std::filesystem::exists(crashed_dir) || std::filesystem::exists(retired) || std::filesystem::exists(staging)) {
+    println("Loading did not restore the graph a crashed compaction moved aside.");
+    return 1;
+  }
+  println("Crash recovery test passed.");
+  return 0;
+}
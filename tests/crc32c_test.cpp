@@ -0,0 +1,75 @@
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <numeric>
+#include <string_view>
+#include <vector>
+#include "crc32c.hpp"
+#include "util.hpp"
+
+namespace {
+
+using crc32c_fn = std::function<std::uint32_t(const unsigned char *, std::size_t)>;
+
+// Check values from RFC 3720, appendix B.4, and the usual "123456789" check string.
+bool known_vectors(std::string_view name, const crc32c_fn &crc) {
+  std::array<unsigned char, 32> zeros{}, ones{}, ascending{}, descending{};
+  ones.fill(0xff);
+  std::iota(ascending.begin(), ascending.end(), 0);
+  std::iota(descending.rbegin(), descending.rend(), 0);
+  std::string_view check = "123456789";
+  struct {
+    const unsigned char *data;
+    std::size_t length;
+    std::uint32_t expected;
+  } vectors[] = {
+    {reinterpret_cast<const unsigned char *>(check.data()), check.size(), 0xe3069283u},
+    {zeros.data(), zeros.size(), 0x8a9136aau},
+    {ones.data(), ones.size(), 0x62a8ab43u},
+    {ascending.data(), ascending.size(), 0x46dd794eu},
+    {descending.data(), descending.size(), 0x113fdb5cu},
+    {nullptr, 0, 0u},
+  };
+  for (const auto &vector : vectors) {
+    if (auto actual = crc(vector.data, vector.length); actual != vector.expected) {
+      println("{}: CRC of {} bytes was {:08x}, expected {:08x}.", name, vector.length, actual, vector.expected);
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main() {
+  auto portable = [](const unsigned char *data, std::size_t length) { return ~crc32c_portable(~0u, data, length); };
+  if (!known_vectors("portable", portable)) return 1;
+  if (!known_vectors("dispatch", [](const unsigned char *data, std::size_t length) { return crc32c(data, length); }))
+    return 1;
+
+  std::vector<unsigned char> data(1031);
+  for (std::size_t i = 0; i < data.size(); ++i) data[i] = static_cast<unsigned char>(i * 131 + 7);
+#if defined(CRC32C_HAS_SSE42_PATH)
+  if (crc32c_hardware()) {
+    auto hardware = [](const unsigned char *data, std::size_t length) { return ~crc32c_sse42(~0u, data, length); };
+    if (!known_vectors("hardware", hardware)) return 1;
+    // Every tail length and misalignment the word loop leaves behind.
+    for (std::size_t offset = 0; offset < 8; ++offset)
+      for (std::size_t length = 0; length + offset <= 64; ++length)
+        if (hardware(data.data() + offset, length) != portable(data.data() + offset, length)) {
+          println("hardware: CRC of {} bytes at offset {} differs from the portable one.", length, offset);
+          return 1;
+        }
+  } else println("SSE4.2 is not available; skipping the hardware path.");
+#endif
+
+  // A running checksum continued across any split equals the checksum of the whole.
+  auto whole = crc32c(data.data(), data.size());
+  for (std::size_t split : {0, 1, 7, 8, 9, 512, 1030, 1031})
+    if (crc32c(data.data() + split, data.size() - split, crc32c(data.data(), split)) != whole) {
+      println("Continuing a CRC after {} bytes changed the result.", split);
+      return 1;
+    }
+  println("CRC32C test passed.");
+  return 0;
+}
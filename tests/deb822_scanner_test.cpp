@@ -0,0 +1,84 @@
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "deb822_scanner.hpp"
+#include "util.hpp"
+
+namespace {
+
+constexpr std::string_view kFields[] = {"Package", "Version", "Depends"};
+
+struct Stanza {
+  std::string_view text;
+  std::vector<std::optional<std::string_view>> values;
+};
+
+std::vector<Stanza> scan(std::string_view text) {
+  std::vector<Stanza> stanzas;
+  deb822_scanner scanner(text, kFields);
+  Stanza stanza{.values = std::vector<std::optional<std::string_view>>(std::size(kFields))};
+  while (scanner.next(stanza.text, stanza.values)) stanzas.push_back(stanza);
+  return stanzas;
+}
+
+bool expect(std::string_view name, std::string_view text, const std::vector<std::vector<std::string_view>> &expected) {
+  auto stanzas = scan(text);
+  // Blank stanzas are what splitting on "\n\n" leaves at the end of the text; the loader skips them.
+  std::erase_if(stanzas, [](const Stanza &stanza) { return trim(stanza.text).empty(); });
+  if (stanzas.size() != expected.size()) {
+    println("{}: scanned {} stanzas, expected {}.", name, stanzas.size(), expected.size());
+    return false;
+  }
+  for (std::size_t i = 0; i < stanzas.size(); ++i)
+    for (std::size_t field = 0; field < std::size(kFields); ++field) {
+      auto value = stanzas[i].values[field].value_or("<unset>");
+      if (value != expected[i][field]) {
+        println("{}: stanza {} has {} \"{}\", expected \"{}\".", name, i, kFields[field], value, expected[i][field]);
+        return false;
+      }
+    }
+  return true;
+}
+
+} // namespace
+
+int main() {
+  bool passed = true;
+  passed &= expect("plain", "Package: a\nVersion: 1\n\nPackage: b\nVersion: 2\nDepends: a\n\n",
+                   {{"a", "1", "<unset>"}, {"b", "2", "a"}});
+  passed &= expect("continuation", "Package: a\nDepends: b,\n c (>= 1),\n\td\nVersion: 1\n",
+                   {{"a", "1", "b,\n c (>= 1),\n\td"}});
+  passed &= expect("repeated field", "Package: a\nPackage: b\nVersion: 1\n", {{"a", "1", "<unset>"}});
+  passed &= expect("extra blank lines", "Package: a\n\n\n\nPackage: b\n\n\n", {{"a", "<unset>", "<unset>"},
+                                                                               {"b", "<unset>", "<unset>"}});
+  passed &= expect("no final newline", "Package: a\nVersion: 1\n\nPackage: b\nVersion: 2",
+                   {{"a", "1", "<unset>"}, {"b", "2", "<unset>"}});
+  passed &= expect("CRLF", "Package: a\r\nVersion: 1\r\nDepends: b,\r\n c\r\n\r\nPackage: b\r\nVersion: 2\r\n",
+                   {{"a", "1", "b,\r\n c"}, {"b", "2", "<unset>"}});
+  passed &= expect("empty", "", {});
+
+  // Input longer than one 64-byte newline block, with separators straddling block boundaries.
+  std::string text;
+  std::vector<std::vector<std::string_view>> expected;
+  std::vector<std::string> names;
+  for (int i = 0; i < 50; ++i) names.push_back("package-" + std::string(i % 7 + 1, 'x') + std::to_string(i));
+  for (const auto &name : names) {
+    text += "Package: " + name + "\nDescription: padding\n" + std::string(name.size() % 3, ' ') + "more\n\n";
+    expected.push_back({name, "<unset>", "<unset>"});
+  }
+  passed &= expect("long input", text, expected);
+
+  // Stanzas must equal the pieces between "\n\n" separators, since their content hashes are recorded.
+  auto stanzas = scan("Package: a\n\nPackage: b\n\n\nPackage: c");
+  std::vector<std::string_view> pieces{"Package: a", "Package: b", "\nPackage: c"};
+  if (stanzas.size() != pieces.size()) passed = false;
+  else
+    for (std::size_t i = 0; i < pieces.size(); ++i) passed &= stanzas[i].text == pieces[i];
+  if (!passed) {
+    println("Deb822 scanner test failed.");
+    return 1;
+  }
+  println("Deb822 scanner test passed.");
+  return 0;
+}
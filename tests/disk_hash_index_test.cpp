@@ -0,0 +1,112 @@
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <iterator>
+#include <thread>
+#include "disk_hash_index.hpp"
+#include "util.hpp"
+
+namespace {
+
+constexpr std::uint32_t kCollidingKeys = 500;
+constexpr std::uint32_t kKeys = 20000;
+
+// All of these fold to 1, 0 included, since a folded zero would mark an empty slot.
+constexpr std::uint64_t kCollidingHashes[] = {0, 1, 0x100000001, 0x200000003};
+
+std::uint64_t colliding_hash(std::uint32_t key) noexcept { return kCollidingHashes[key % std::size(kCollidingHashes)]; }
+
+std::uint64_t distinct_hash(std::uint32_t key) noexcept { return stable_hash_combine(0x5eed, key); }
+
+bool find_all(const disk_hash_index<std::uint32_t> &index, std::uint32_t count) {
+  for (std::uint32_t key = 0; key < kCollidingKeys; ++key) {
+    auto found = index.find(colliding_hash(key), [key](std::uint32_t candidate) { return candidate == key; });
+    if (found != key) {
+      println("Colliding key {} was not found.", key);
+      return false;
+    }
+  }
+  for (std::uint32_t key = kCollidingKeys; key < count; ++key) {
+    auto found = index.find(distinct_hash(key), [key](std::uint32_t candidate) { return candidate == key; });
+    if (found != key) {
+      println("Key {} was not found.", key);
+      return false;
+    }
+  }
+  if (index.find(colliding_hash(0), [](std::uint32_t) { return false; })) {
+    println("A lookup whose predicate rejects every candidate found a key.");
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+int main() {
+  std::filesystem::remove_all("./temp/disk_hash_index_test");
+  std::filesystem::create_directories("./temp/disk_hash_index_test");
+  auto path = "./temp/disk_hash_index_test/index.dat";
+  {
+    disk_hash_index<std::uint32_t> index;
+    if (index.open(path, kCreate) != kCreateSuccess) {
+      println("Failed to create hash index at: {}", path);
+      return 1;
+    }
+    if (index.find(0, [](std::uint32_t) { return true; })) {
+      println("An empty index found a key.");
+      return 1;
+    }
+    for (std::uint32_t key = 0; key < kCollidingKeys; ++key) index.insert(colliding_hash(key), key);
+    if (!find_all(index, kCollidingKeys)) return 1;
+
+    // A reader probing keys inserted before it started must find them across every rehash the writer publishes.
+    std::atomic<bool> done = false;
+    std::atomic<bool> missed = false;
+    std::thread reader([&] {
+      while (!done.load(std::memory_order_acquire))
+        for (std::uint32_t key = 0; key < kCollidingKeys; key += 7)
+          if (index.find(colliding_hash(key), [key](std::uint32_t candidate) { return candidate == key; }) != key)
+            missed = true;
+    });
+    std::size_t rehashes = 0;
+    for (std::uint32_t key = kCollidingKeys; key < kKeys; ++key) {
+      auto bucket_count = index.bucket_count();
+      index.insert(distinct_hash(key), key);
+      rehashes += index.bucket_count() != bucket_count;
+      if (index.size() * 4 > index.bucket_count() * 3) {
+        println("The index holds {} keys in {} buckets.", index.size(), index.bucket_count());
+        return 1;
+      }
+    }
+    done = true;
+    reader.join();
+    if (missed || rehashes < 5 || index.size() != kKeys || !find_all(index, kKeys)) {
+      println("Lookups failed across {} rehashes.", rehashes);
+      return 1;
+    }
+    index.sync();
+  }
+
+  disk_hash_index<std::uint32_t> reopened;
+  if (reopened.open(path, kReadOnly) != kLoadSuccess || reopened.size() != kKeys || !find_all(reopened, kKeys)) {
+    println("The reopened index lost keys.");
+    return 1;
+  }
+  reopened.close();
+  if (reopened.open(path, kLoad) != kLoadSuccess) return 1;
+  auto bytes = reopened.size_bytes();
+  reopened.shrink_to_fit();
+  reopened.close();
+  if (reopened.open(path, kLoad) != kLoadSuccess || reopened.size_bytes() * 3 > bytes * 2
+    || reopened.size() != kKeys || !find_all(reopened, kKeys)) {
+    println("Shrinking the index from {} to {} bytes lost keys.", bytes, reopened.size_bytes());
+    return 1;
+  }
+  reopened.clear();
+  if (!reopened.empty() || reopened.find(distinct_hash(kCollidingKeys), [](std::uint32_t) { return true; })) {
+    println("A cleared index still found keys.");
+    return 1;
+  }
+  println("Disk hash index test passed.");
+  return 0;
+}
@@ -0,0 +1,40 @@
+#include <vector>
+#include "epoch.hpp"
+#include "util.hpp"
+
+int main() {
+  epoch_domain domain;
+  // More readers than there are slots, so the last ones share the overflow slot.
+  std::vector<epoch_guard> guards;
+  for (std::size_t i = 0; i < epoch_domain::kMaxReaders + 8; ++i) guards.push_back(domain.pin());
+  bool reclaimed = false;
+  domain.retire([&reclaimed] { reclaimed = true; });
+  for (std::size_t i = 0; i < epoch_domain::kMaxReaders + 7; ++i) {
+    guards[i].release();
+    domain.collect();
+  }
+  if (reclaimed) {
+    println("Memory was reclaimed while a reader in the overflow slot still pinned it.");
+    return 1;
+  }
+  guards.back().release();
+  domain.collect();
+  if (!reclaimed) {
+    println("Memory was not reclaimed after every reader released it.");
+    return 1;
+  }
+
+  // Readers pinned after a retirement do not hold it back, including those sharing the overflow slot.
+  auto early = domain.pin();
+  reclaimed = false;
+  domain.retire([&reclaimed] { reclaimed = true; });
+  for (auto &guard : guards) guard = domain.pin();
+  early.release();
+  domain.collect();
+  if (!reclaimed) {
+    println("Readers pinned after a retirement held it back.");
+    return 1;
+  }
+  println("Epoch test passed.");
+  return 0;
+}
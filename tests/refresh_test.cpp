@@ -0,0 +1,94 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include "dependency_graph.hpp"
+#include "package_loader.hpp"
+#include "util.hpp"
+
+namespace {
+
+void write_packages(const std::filesystem::path &path, std::string_view constraint, bool with_tools) {
+  std::ofstream os(path, std::ios::trunc);
+  os << "Package: app\nVersion: 1.0\nArchitecture: amd64\nDepends: libfoo (" << constraint << ")\n\n";
+  os << "Package: libfoo\nVersion: 2.0\nArchitecture: amd64\n\n";
+  if (with_tools) os << "Package: tools\nVersion: 0.1\nArchitecture: amd64\nDepends: app\n\n";
+}
+
+// The version constraint app depends on, or an empty string if app has no single live version with one dependency.
+std::string app_constraint(const DependencyGraph &graph, const DiskGraph::Snapshot &snapshot) {
+  auto result = graph.query_dependencies(snapshot, "app", "", "", 1, false);
+  if (result.empty() || result[0].direct_dependencies.size() != 1) return {};
+  return std::string(result[0].direct_dependencies[0].version_constraint);
+}
+
+} // namespace
+
+int main() {
+  std::filesystem::remove_all("./temp/refresh_test");
+  std::filesystem::create_directories("./temp/refresh_test");
+  std::filesystem::path packages = "./temp/refresh_test/Packages";
+  DependencyGraph graph(0);
+  if (!graph.open("./temp/refresh_test/graph", kCreate)) {
+    println("Failed to create DependencyGraph at directory: {}", "./temp/refresh_test/graph");
+    return 1;
+  }
+  PackageLoader loader(graph);
+
+  write_packages(packages, ">= 1.0", true);
+  if (!loader.refresh_packages_file(packages)) return 1;
+  auto before = graph.snapshot();
+  if (app_constraint(graph, before) != ">= 1.0" || graph.version_count() != 3) {
+    println("Initial load did not hold the expected versions.");
+    return 1;
+  }
+
+  // Editing a dependency in place keeps package, version and architecture but must replace the version.
+  write_packages(packages, ">= 2.0.1", false);
+  if (!loader.refresh_packages_file(packages)) return 1;
+  auto after = graph.snapshot();
+  if (app_constraint(graph, after) != ">= 2.0.1") {
+    println("Refresh kept the stale dependency of an edited stanza.");
+    return 1;
+  }
+  if (graph.version_count() != 4 || graph.tombstone_count() != 2) {
+    println("Refresh left {} versions and {} tombstones, expected 4 and 2.", graph.version_count(),
+            graph.tombstone_count());
+    return 1;
+  }
+  auto app = graph.get_package("app");
+  auto tools = graph.get_package("tools");
+  if (!app || app->versions().size() != 1 || !tools || !tools->versions().empty()) {
+    println("Tombstoned versions are still listed.");
+    return 1;
+  }
+  // Tombstones logged after a snapshot was taken do not apply to it.
+  auto tools_result = graph.query_dependencies(before, "tools", "", "", 1, false);
+  if (app_constraint(graph, before) != ">= 1.0" || tools_result[0].direct_dependencies.size() != 1) {
+    println("An older snapshot saw tombstones logged after it.");
+    return 1;
+  }
+  before.release();
+  after.release();
+
+  graph.compact();
+  if (graph.version_count() != 2 || graph.tombstone_count() != 0
+    || app_constraint(graph, graph.snapshot()) != ">= 2.0.1") {
+    println("Compaction did not keep exactly the live versions.");
+    return 1;
+  }
+  // An unchanged file is skipped, and reloading the compacted graph finds the same versions.
+  if (!loader.refresh_packages_file(packages) || graph.version_count() != 2) {
+    println("Refreshing an unchanged file changed the graph.");
+    return 1;
+  }
+  graph.close();
+  DependencyGraph reopened;
+  if (!reopened.open("./temp/refresh_test/graph", kLoad) || reopened.version_count() != 2
+    || app_constraint(reopened, reopened.snapshot()) != ">= 2.0.1") {
+    println("The compacted graph did not reload.");
+    return 1;
+  }
+  println("Refresh test passed.");
+  return 0;
+}
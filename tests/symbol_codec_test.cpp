@@ -0,0 +1,105 @@
+#include <filesystem>
+#include <format>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "buffer_graph.hpp"
+#include "disk_graph.hpp"
+#include "epoch.hpp"
+#include "string_pool.hpp"
+#include "symbol_codec.hpp"
+#include "util.hpp"
+
+namespace {
+
+bool round_trip(const symbol_codec &codec, std::string_view str) {
+  std::string codes(symbol_codec::max_encoded_length(str.size()), '\0');
+  codes.resize(codec.encode(str, codes.data()));
+  std::string decoded(str.size() + symbol_codec::kMaxSymbolLength, '\0');
+  const auto *end = codes.data() + codes.size();
+  if (codec.decode(codes.data(), end, decoded.data(), str.size()) != end) return false;
+  if (std::string_view(decoded.data(), str.size()) != str || !codec.equal(codes.data(), end, str)) return false;
+  if (str.empty()) return true;
+  // Codes cut short must not decode or compare equal.
+  return !codec.decode(codes.data(), end - 1, decoded.data(), str.size()) && !codec.equal(codes.data(), end - 1, str);
+}
+
+} // namespace
+
+int main() {
+  symbol_codec codec;
+  std::string all_bytes;
+  for (int c = 0; c < 256; ++c) all_bytes += static_cast<char>(c);
+  std::vector<std::string> samples{
+    "", "libc6-dev", "python3-numpy", ">= 2.36-9+deb12u4", "1:2.0~rc1+dfsg-1", "UPPER_CASE/Path!", all_bytes,
+    std::string(3, static_cast<char>(symbol_codec::kEscape)), std::string("nul\0byte", 8)
+  };
+  for (const auto &sample : samples) {
+    if (!round_trip(codec, sample)) {
+      println("Round trip failed for a string of {} bytes.", sample.size());
+      return 1;
+    }
+  }
+
+  std::filesystem::remove_all("./temp/symbol_codec_test");
+  std::filesystem::create_directories("./temp/symbol_codec_test");
+  string_pool<> pool;
+  if (pool.open("./temp/symbol_codec_test/string-pool.dat", kCreate) != kCreateSuccess) {
+    println("Failed to create string pool at: {}", "./temp/symbol_codec_test/string-pool.dat");
+    return 1;
+  }
+  pool.set_compressed(true);
+  // Enough distinct strings to fill the decode cache several times over.
+  std::vector<std::string> strings;
+  std::vector<string_handle> handles;
+  for (std::size_t i = 0; i < 40000; ++i) {
+    strings.emplace_back(std::format("libtest{}-{}-dev (>= {}.{}~rc{}) \xff", i, i * 7919, i % 13, i % 101, i));
+    handles.emplace_back(pool.add(strings.back()));
+  }
+
+  auto guard = epoch_domain::global().pin();
+  auto first = pool.get(handles.front());
+  for (std::size_t pass = 0; pass < 2; ++pass) {
+    for (std::size_t i = 0; i < strings.size(); ++i) {
+      if (pool.get(handles[i]) != strings[i] || !pool.equal(handles[i], strings[i])) {
+        println("Compressed pool returned a wrong string at index {}.", i);
+        return 1;
+      }
+    }
+  }
+  if (first != strings.front()) {
+    println("A view of the decode cache changed while pinned.");
+    return 1;
+  }
+  guard.release();
+
+  // A handle whose codes run past the end of the pool reads as a miss.
+  string_handle tail{.offset = static_cast<string_handle::offset_type>(pool.size() - 1), .length = 200};
+  std::string buffer;
+  if (!pool.get(tail).empty() || !pool.get(tail, buffer).empty() || pool.equal(tail, std::string(200, 'a'))) {
+    println("A short read past the end of the pool was not treated as a miss.");
+    return 1;
+  }
+
+  // Views of a compressed graph stay valid without a pinned snapshot, however much is decoded after them.
+  DiskGraph graph;
+  graph.set_background_verify(false);
+  graph.set_compressed_strings(true);
+  if (graph.open("./temp/symbol_codec_test/graph", kCreate) != kCreateSuccess || !graph.compressed_strings()) {
+    println("Failed to create a compressed DiskGraph.");
+    return 1;
+  }
+  BufferGraph bgraph;
+  for (const auto &str : strings) bgraph.create_package(str);
+  graph.ingest(bgraph);
+  graph.commit();
+  auto package = graph.get_package(0);
+  for (std::size_t pass = 0; pass < 2; ++pass)
+    for (PackageId pid = 0; pid < graph.package_count(); ++pid) graph.get_package(pid);
+  if (package.name != strings.front()) {
+    println("A view of a compressed graph changed after its decode cache was retired.");
+    return 1;
+  }
+  println("Symbol codec test passed.");
+  return 0;
+}